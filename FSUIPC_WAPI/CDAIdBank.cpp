@@ -1,14 +1,16 @@
 #include "CDAIdBank.h"
 #include "SimConnect.h"
+#define LOGGER_INSTANCE logger // Log to the logger of the owning WASMIF instance
 #include "Logger.h"
 
 using namespace std;
 using namespace CDAIdBankMSFS;
 using namespace CPlusPlusLogging;
 
-CDAIdBank::CDAIdBank(int id, HANDLE hSimConnect) {
+CDAIdBank::CDAIdBank(int id, HANDLE hSimConnect, Logger* logger) {
 	nextId = id;
 	this->hSimConnect = hSimConnect;
+	this->logger = logger;
 }
 
 CDAIdBank::~CDAIdBank() {
@@ -9,10 +9,12 @@
 
 using namespace std;
 
+namespace CPlusPlusLogging { class Logger; }
+
 namespace CDAIdBankMSFS {
   class CDAIdBank {
 	public:
-		CDAIdBank(int id, HANDLE hSimConnect);
+		CDAIdBank(int id, HANDLE hSimConnect, CPlusPlusLogging::Logger* logger);
 		~CDAIdBank();
 		pair<string, int> getId(int size, string);
 		void returnId(string name);
@@ -24,5 +26,6 @@ namespace CDAIdBankMSFS {
 		multimap<string, pair<int, int>> availableBank; // keyed on name
 		map<string, pair<int, int>> outBank; // keyed on name
 		HANDLE  hSimConnect;
+		CPlusPlusLogging::Logger* logger;
   };
 } // End of namespace
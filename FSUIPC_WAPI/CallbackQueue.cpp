@@ -0,0 +1,148 @@
+#include "CallbackQueue.h"
+
+using namespace std;
+using namespace CallbackQueueMSFS;
+
+
+CallbackQueue::CallbackQueue(size_t capacity, bool coalesceOnOverflow)
+{
+	size_t noCells = 2;
+	while (noCells < capacity) noCells <<= 1;
+	cells = new Cell[noCells];
+	for (size_t i = 0; i < noCells; i++) cells[i].sequence.store(i, memory_order_relaxed);
+	mask = noCells - 1;
+	enqueuePos = 0;
+	dequeuePos = 0;
+	this->coalesceOnOverflow = coalesceOnOverflow;
+	overflowPending = false;
+	dropped = 0;
+	coalesced = 0;
+	InitializeCriticalSection(&overflowMutex);
+}
+
+CallbackQueue::~CallbackQueue()
+{
+	delete[] cells;
+	DeleteCriticalSection(&overflowMutex);
+}
+
+bool CallbackQueue::tryPush(const QueueEntry& entry)
+{
+	Cell* cell;
+	size_t pos = enqueuePos.load(memory_order_relaxed);
+	for (;;) {
+		cell = &cells[pos & mask];
+		size_t seq = cell->sequence.load(memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif == 0) {
+			if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+		}
+		else if (dif < 0) return false; // Full
+		else pos = enqueuePos.load(memory_order_relaxed);
+	}
+	cell->entry = entry;
+	cell->sequence.store(pos + 1, memory_order_release);
+	return true;
+}
+
+bool CallbackQueue::pop(QueueEntry& entry)
+{
+	Cell* cell;
+	size_t pos = dequeuePos.load(memory_order_relaxed);
+	for (;;) {
+		cell = &cells[pos & mask];
+		size_t seq = cell->sequence.load(memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (dif == 0) {
+			if (dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+		}
+		else if (dif < 0) return false; // Empty
+		else pos = dequeuePos.load(memory_order_relaxed);
+	}
+	entry = cell->entry;
+	cell->sequence.store(pos + mask + 1, memory_order_release);
+	return true;
+}
+
+void CallbackQueue::push(int id, double value, int targets)
+{
+	QueueEntry entry = { id, value, targets };
+
+	if (coalesceOnOverflow) {
+		// Once we have overflowed, keep coalescing until the worker has taken the overflow
+		if (overflowPending.load(memory_order_acquire) || !tryPush(entry)) {
+			EnterCriticalSection(&overflowMutex);
+			auto it = overflow.find(id);
+			if (it != overflow.end()) {
+				// Only a replaced update has been coalesced away
+				it->second.value = value;
+				it->second.targets |= targets;
+				coalesced++;
+			}
+			else overflow[id] = entry;
+			overflowPending.store(true, memory_order_release);
+			LeaveCriticalSection(&overflowMutex);
+		}
+		return;
+	}
+
+	while (!tryPush(entry)) {
+		QueueEntry oldest;
+		if (pop(oldest) && oldest.id != END_OF_BATCH) dropped++;
+	}
+}
+
+void CallbackQueue::endBatch()
+{
+	// Batch markers are only needed when the batch went into the ring
+	if (coalesceOnOverflow && overflowPending.load(memory_order_acquire)) return;
+	QueueEntry entry = { END_OF_BATCH, 0.0, 0 };
+	while (!tryPush(entry)) {
+		if (coalesceOnOverflow) return;
+		QueueEntry oldest;
+		if (pop(oldest) && oldest.id != END_OF_BATCH) dropped++;
+	}
+}
+
+void CallbackQueue::clear()
+{
+	QueueEntry entry;
+	while (pop(entry));
+	EnterCriticalSection(&overflowMutex);
+	overflow.clear();
+	overflowPending.store(false, memory_order_release);
+	LeaveCriticalSection(&overflowMutex);
+}
+
+bool CallbackQueue::takeOverflow(map<int, QueueEntry>& updates)
+{
+	if (!overflowPending.load(memory_order_acquire)) return false;
+	EnterCriticalSection(&overflowMutex);
+	// The ring only holds updates older than the overflow, so it must be drained first
+	if (getDepth()) {
+		LeaveCriticalSection(&overflowMutex);
+		return false;
+	}
+	updates.swap(overflow);
+	overflow.clear();
+	overflowPending.store(false, memory_order_release);
+	LeaveCriticalSection(&overflowMutex);
+	return !updates.empty();
+}
+
+size_t CallbackQueue::getDepth()
+{
+	size_t enqueued = enqueuePos.load(memory_order_relaxed);
+	size_t dequeued = dequeuePos.load(memory_order_relaxed);
+	return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+unsigned long long CallbackQueue::getDropped()
+{
+	return dropped;
+}
+
+unsigned long long CallbackQueue::getCoalesced()
+{
+	return coalesced;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <windows.h>
+#include <atomic>
+#include <map>
+
+using namespace std;
+
+namespace CallbackQueueMSFS
+{
+	// Bounded queue of lvar updates passed from the SimConnect thread to the callback worker thread.
+	// This is a lock-free bounded MPMC ring (sequence number per cell). Only the SimConnect thread
+	// pushes, but it may also pop to discard the oldest entry when the queue is full.
+	// When full, updates are either coalesced per lvar in an overflow map (which is then used for
+	// all updates until the worker has drained it, to keep last-value-wins ordering), or the
+	// oldest queued update is dropped.
+	class CallbackQueue
+	{
+	public:
+		typedef struct _QueueEntry
+		{
+			int id; // lvar id, or END_OF_BATCH
+			double value;
+			int targets; // Who the update is for. Combined when updates are coalesced
+		} QueueEntry;
+		static const int END_OF_BATCH = -1;
+
+		CallbackQueue(size_t capacity, bool coalesceOnOverflow);
+		~CallbackQueue();
+
+		// Producer interface - SimConnect thread only
+		void push(int id, double value, int targets);
+		void endBatch();
+		void clear(); // Discards everything queued
+
+		// Consumer interface - worker thread
+		bool pop(QueueEntry& entry);
+		bool takeOverflow(map<int, QueueEntry>& updates); // Takes the coalesced updates, if any, once the ring has been drained
+
+		size_t getDepth();
+		unsigned long long getDropped();
+		unsigned long long getCoalesced();
+
+	protected:
+
+	private:
+		typedef struct _Cell
+		{
+			atomic<size_t> sequence;
+			QueueEntry entry;
+		} Cell;
+
+		bool tryPush(const QueueEntry& entry);
+
+		Cell* cells;
+		size_t mask;
+		atomic<size_t> enqueuePos;
+		atomic<size_t> dequeuePos;
+		bool coalesceOnOverflow;
+		atomic<bool> overflowPending;
+		map<int, QueueEntry> overflow;
+		CRITICAL_SECTION overflowMutex;
+		atomic<unsigned long long> dropped;
+		atomic<unsigned long long> coalesced;
+	};
+} // End of namespace
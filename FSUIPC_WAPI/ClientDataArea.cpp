@@ -20,9 +20,13 @@ ClientDataArea::ClientDataArea(const string& cdaName, int size, CDAType type)
 		case VALUEF:
 			noItems = size / sizeof(CDAValue);
 			break;
+		case DELTAF:
+			noItems = (size - sizeof(int)) / sizeof(CDALvarValue);
+			break;
 	}
 
 	this->id = 0;
+	this->startIndex = 0;
 	this->name = string(cdaName);
 	this->noItems = noItems;
 	this->size = size;
@@ -32,6 +36,7 @@ ClientDataArea::ClientDataArea(const string& cdaName, int size, CDAType type)
 ClientDataArea::ClientDataArea()
 {
 	this->id = 0;
+	this->startIndex = 0;
 	this->size = 0;
 	this->noItems = 0;
 };
@@ -77,3 +82,13 @@ void ClientDataArea::setDefinitionId(int id)
 {
 	definitionId = id;
 }
+
+int ClientDataArea::getStartIndex()
+{
+	return startIndex;
+}
+
+void ClientDataArea::setStartIndex(int index)
+{
+	startIndex = index;
+}
@@ -22,6 +22,8 @@ namespace ClientDataAreaMSFS
 		CDAType getType();
 		int getId();
 		void setId(int id);	
+		int getStartIndex();
+		void setStartIndex(int index);
 
 	protected:
 
@@ -31,6 +33,7 @@ namespace ClientDataAreaMSFS
 		int size;
 		int noItems;
 		int definitionId;
+		int startIndex; // Index of the first lvar/hvar held in this CDA
 		CDAType type;
 	};
 } // End of namespace
@@ -0,0 +1,37 @@
+#include "LatencyHistogram.h"
+
+using namespace std;
+using namespace LatencyHistogramMSFS;
+
+
+LatencyHistogram::LatencyHistogram()
+{
+	clear();
+}
+
+void LatencyHistogram::record(unsigned long long sample)
+{
+	int bucket = 0;
+	while (sample && bucket < NO_BUCKETS - 1) {
+		sample >>= 1;
+		bucket++;
+	}
+	buckets[bucket].fetch_add(1, memory_order_relaxed);
+	count.fetch_add(1, memory_order_relaxed);
+}
+
+void LatencyHistogram::getCounts(unsigned long long counts[NO_BUCKETS])
+{
+	for (int i = 0; i < NO_BUCKETS; i++) counts[i] = buckets[i].load(memory_order_relaxed);
+}
+
+unsigned long long LatencyHistogram::getCount()
+{
+	return count.load(memory_order_relaxed);
+}
+
+void LatencyHistogram::clear()
+{
+	for (int i = 0; i < NO_BUCKETS; i++) buckets[i].store(0, memory_order_relaxed);
+	count.store(0, memory_order_relaxed);
+}
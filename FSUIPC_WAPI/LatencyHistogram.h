@@ -0,0 +1,30 @@
+#pragma once
+
+#include <atomic>
+
+using namespace std;
+
+namespace LatencyHistogramMSFS
+{
+	// Histogram of latencies (or any non-negative sample) in power-of-two buckets.
+	// Bucket 0 counts samples of 0, and bucket i counts samples in [2^(i-1), 2^i).
+	// The last bucket also counts anything larger. Recording is lock-free, from any thread.
+	class LatencyHistogram
+	{
+	public:
+		static const int NO_BUCKETS = 32;
+
+		LatencyHistogram();
+
+		void record(unsigned long long sample);
+		void getCounts(unsigned long long counts[NO_BUCKETS]);
+		unsigned long long getCount();
+		void clear();
+
+	protected:
+
+	private:
+		atomic<unsigned long long> buckets[NO_BUCKETS];
+		atomic<unsigned long long> count;
+	};
+} // End of namespace
@@ -107,6 +107,18 @@ Logger* Logger::getInstance(void (*loggerFunction)(const char* fmt)) throw ()
     }
     return m_Instance;
 }
+Logger* Logger::createInstance(const char* text) throw ()
+{
+    return new Logger(text);
+}
+Logger* Logger::createInstance(void (*loggerFunction)(const char* fmt)) throw ()
+{
+    return new Logger(loggerFunction);
+}
+void Logger::destroyInstance(Logger* logger) throw ()
+{
+    if (logger != m_Instance) delete logger;
+}
 void Logger::setLoggerFunction(void (*loggerFunction)(const char* fmt))
 {
     this->loggerFunction = loggerFunction;
@@ -369,6 +381,11 @@ void Logger::updateLogLevel(LogLevel logLevel)
    m_LogLevel = logLevel;
 }
 
+LogLevel Logger::getLogLevel()
+{
+   return m_LogLevel;
+}
+
 // Enable all log levels
 void Logger::enaleLog()
 {
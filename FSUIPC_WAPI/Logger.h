@@ -38,14 +38,20 @@
 
 namespace CPlusPlusLogging
 {
+   // The Logger used by the MACRO(s). A source file can define this before including
+   // this file to log to its own Logger instance (see Logger::createInstance)
+   #ifndef LOGGER_INSTANCE
+   #define LOGGER_INSTANCE Logger::getInstance()
+   #endif
+
    // Direct Interface for logging into log file or console using MACRO(s)
-   #define LOG_ERROR(x)    Logger::getInstance()->error(x)
-   #define LOG_ALARM(x)	   Logger::getInstance()->alarm(x)
-   #define LOG_ALWAYS(x)	Logger::getInstance()->always(x)
-   #define LOG_INFO(x)     Logger::getInstance()->info(x)
-   #define LOG_BUFFER(x)   Logger::getInstance()->buffer(x)
-   #define LOG_TRACE(x)    Logger::getInstance()->trace(x)
-   #define LOG_DEBUG(x)    Logger::getInstance()->debug(x)
+   #define LOG_ERROR(x)    LOGGER_INSTANCE->error(x)
+   #define LOG_ALARM(x)	   LOGGER_INSTANCE->alarm(x)
+   #define LOG_ALWAYS(x)	LOGGER_INSTANCE->always(x)
+   #define LOG_INFO(x)     LOGGER_INSTANCE->info(x)
+   #define LOG_BUFFER(x)   LOGGER_INSTANCE->buffer(x)
+   #define LOG_TRACE(x)    LOGGER_INSTANCE->trace(x)
+   #define LOG_DEBUG(x)    LOGGER_INSTANCE->debug(x)
 
    // enum for LOG_LEVEL
    typedef enum LOG_LEVEL
@@ -73,6 +79,10 @@ namespace CPlusPlusLogging
           static Logger* getInstance(const char* text) throw ();
           static Logger* getInstance(void (*loggerFunction)(const char* fmt)) throw ();
           static Logger* getInstance() throw ();
+          // Creates a Logger that is separate from the singleton
+          static Logger* createInstance(const char* text) throw ();
+          static Logger* createInstance(void (*loggerFunction)(const char* fmt)) throw ();
+          static void destroyInstance(Logger* logger) throw (); // Only for Loggers from createInstance
 
          // Interface for Error Log 
          void error(const char* text) throw();
@@ -114,6 +124,7 @@ namespace CPlusPlusLogging
 
          // Interfaces to control log levels
          void updateLogLevel(LogLevel logLevel);
+         LogLevel getLogLevel();
          void enaleLog();  // Enable all log levels
          void disableLog(); // Disable all log levels, except error and alarm
 
@@ -0,0 +1,160 @@
+#include "LvarChangeTracker.h"
+#include <algorithm>
+
+using namespace std;
+using namespace LvarChangeTrackerMSFS;
+
+
+LvarChangeTracker::LvarChangeTracker(size_t journalSize)
+{
+	journal.resize(journalSize);
+	journalHead = 0;
+	journalCount = 0;
+	generation = 0;
+	completedGeneration = 0;
+	droppedGeneration = 0;
+	InitializeCriticalSection(&mutex);
+}
+
+LvarChangeTracker::~LvarChangeTracker()
+{
+	DeleteCriticalSection(&mutex);
+}
+
+void LvarChangeTracker::clear()
+{
+	EnterCriticalSection(&mutex);
+	stamps.clear();
+	journalHead = 0;
+	journalCount = 0;
+	// The ids have changed meaning, so nothing before this point can be reported from the journal
+	droppedGeneration = ++generation;
+	completedGeneration = generation;
+	LeaveCriticalSection(&mutex);
+}
+
+void LvarChangeTracker::resize(size_t noLvars)
+{
+	EnterCriticalSection(&mutex);
+	if (noLvars > stamps.size()) {
+		generation++;
+		stamps.resize(noLvars, generation);
+		// New lvars are not journalled, so force a scan for pollers behind this point
+		droppedGeneration = generation;
+		completedGeneration = generation;
+	}
+	else if (noLvars < stamps.size()) {
+		stamps.resize(noLvars);
+		// The journal may hold entries for the dropped ids, so force a scan for pollers behind this point
+		droppedGeneration = generation;
+	}
+	LeaveCriticalSection(&mutex);
+}
+
+// The lock is only held for each change, not for a whole update, so that pollers and the
+// SimConnect thread never wait long for each other. Pollers only see completed generations.
+void LvarChangeTracker::beginUpdate()
+{
+	EnterCriticalSection(&mutex);
+	generation++;
+	LeaveCriticalSection(&mutex);
+}
+
+void LvarChangeTracker::markChanged(int id)
+{
+	EnterCriticalSection(&mutex);
+	if (id < 0 || id >= (int)stamps.size()) {
+		LeaveCriticalSection(&mutex);
+		return;
+	}
+	stamps[id] = generation;
+	if (journal.empty()) droppedGeneration = generation;
+	else {
+		if (journalCount == journal.size()) droppedGeneration = journal[journalHead].generation;
+		else journalCount++;
+		journal[journalHead].generation = generation;
+		journal[journalHead].id = id;
+		journalHead = (journalHead + 1) % journal.size();
+	}
+	LeaveCriticalSection(&mutex);
+}
+
+void LvarChangeTracker::endUpdate()
+{
+	EnterCriticalSection(&mutex);
+	completedGeneration = generation;
+	LeaveCriticalSection(&mutex);
+}
+
+unsigned long long LvarChangeTracker::getGeneration()
+{
+	EnterCriticalSection(&mutex);
+	unsigned long long result = completedGeneration;
+	LeaveCriticalSection(&mutex);
+	return result;
+}
+
+size_t LvarChangeTracker::getChangedSince(const LvarChangeCursor& since, int* ids, size_t maxIds, LvarChangeCursor& next)
+{
+	size_t noIds = 0;
+	vector<JournalEntry> scanned; // The changes to report
+
+	// Only the last change of each lvar is reported (its stamp matches the entry generation), and
+	// only from completed generations. A stamp from an update in progress hides the lvar's earlier
+	// change, but the lvar is then reported with that update once it completes.
+	// The changes are copied under the lock, and sorted after it is released.
+	EnterCriticalSection(&mutex);
+	unsigned long long visibleGeneration = completedGeneration;
+	next.generation = visibleGeneration;
+	next.lastId = -1;
+	if (since.generation >= visibleGeneration) {
+		LeaveCriticalSection(&mutex);
+		return 0;
+	}
+	unsigned long long partialGeneration = since.generation + 1;
+	auto wanted = [&](unsigned long long g, int id) {
+		return g <= visibleGeneration && (g > partialGeneration || (g == partialGeneration && id > since.lastId));
+	};
+	if (!journal.empty() && droppedGeneration <= since.generation) {
+		scanned.reserve(journalCount);
+		size_t entry = (journalHead + journal.size() - journalCount) % journal.size();
+		for (size_t i = 0; i < journalCount; i++, entry = (entry + 1) % journal.size()) {
+			const JournalEntry& e = journal[entry];
+			if (e.id < (int)stamps.size() && stamps[e.id] == e.generation && wanted(e.generation, e.id)) scanned.push_back(e);
+		}
+	}
+	else {
+		for (int id = 0; id < (int)stamps.size(); id++) {
+			if (wanted(stamps[id], id)) scanned.push_back({ stamps[id], id });
+		}
+	}
+	LeaveCriticalSection(&mutex);
+
+	// Changes are reported in (generation, id) order, so if the ids buffer fills up the cursor can
+	// be set to resume from the first change not reported, even part way through a generation.
+	auto before = [](const JournalEntry& a, const JournalEntry& b) {
+		return a.generation < b.generation || (a.generation == b.generation && a.id < b.id);
+	};
+	auto same = [](const JournalEntry& a, const JournalEntry& b) { return a.generation == b.generation && a.id == b.id; };
+	sort(scanned.begin(), scanned.end(), before);
+	scanned.erase(unique(scanned.begin(), scanned.end(), same), scanned.end());
+
+	for (const JournalEntry& e : scanned) {
+		if (noIds == maxIds) {
+			if (noIds == 0) {
+				next = since;
+				break;
+			}
+			const JournalEntry& last = scanned[noIds - 1];
+			if (last.generation == e.generation) {
+				next.generation = e.generation - 1;
+				next.lastId = last.id;
+			}
+			else next.generation = last.generation;
+			break;
+		}
+		ids[noIds++] = e.id;
+	}
+
+	return noIds;
+}
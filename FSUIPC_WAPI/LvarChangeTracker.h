@@ -0,0 +1,59 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+
+using namespace std;
+
+namespace LvarChangeTrackerMSFS
+{
+	// Position of a poller in the change stream: all changes up to and including generation have
+	// been returned, along with the changes in the following generation to lvars with ids up to lastId.
+	// lastId is -1 when no part of the following generation has been returned.
+	typedef struct _LvarChangeCursor
+	{
+		unsigned long long generation;
+		int lastId;
+	} LvarChangeCursor;
+
+	// Tracks which lvars changed in which update so that pollers can ask for the lvars
+	// changed since a given generation. Each value CDA update that changes something gets
+	// a new generation number, and each lvar is stamped with the generation it last changed in.
+	// A bounded journal of (generation, id) entries lets recent deltas be found without scanning
+	// all lvars; when a poller is further behind than the journal holds, the stamps are scanned.
+	class LvarChangeTracker
+	{
+	public:
+		LvarChangeTracker(size_t journalSize);
+		~LvarChangeTracker();
+
+		// Writer interface - SimConnect thread only
+		void clear();
+		void resize(size_t noLvars); // Added lvars are stamped with a new generation, so pollers see them as changed
+		void beginUpdate(); // Starts a new generation
+		void markChanged(int id);
+		void endUpdate();
+
+		// Reader interface - any thread
+		unsigned long long getGeneration();
+		size_t getChangedSince(const LvarChangeCursor& since, int* ids, size_t maxIds, LvarChangeCursor& next);
+
+	protected:
+
+	private:
+		typedef struct _JournalEntry
+		{
+			unsigned long long generation;
+			int id;
+		} JournalEntry;
+
+		vector<unsigned long long> stamps; // Generation in which each lvar last changed
+		vector<JournalEntry> journal; // Ring buffer
+		size_t journalHead; // Next entry to write
+		size_t journalCount;
+		unsigned long long generation; // Latest generation, which may still be in progress
+		unsigned long long completedGeneration; // Latest generation whose update has ended
+		unsigned long long droppedGeneration; // Highest generation with entries no longer in the journal
+		CRITICAL_SECTION mutex;
+	};
+} // End of namespace
@@ -0,0 +1,28 @@
+#include "LvarHandle.h"
+
+using namespace std;
+using namespace LvarHandleMSFS;
+
+
+LvarHandle::LvarHandle()
+{
+	this->id = -1;
+	this->generation = 0;
+}
+
+LvarHandle::LvarHandle(const char* lvarName)
+{
+	this->name = string(lvarName ? lvarName : "");
+	this->id = -1;
+	this->generation = 0;
+}
+
+const char* LvarHandle::getName()
+{
+	return name.c_str();
+}
+
+int LvarHandle::getId()
+{
+	return id;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+using namespace std;
+
+class WASMIF;
+
+namespace LvarHandleMSFS
+{
+	// A resolved reference to an lvar. The name is looked up once and the id is then
+	// used directly. The handle records the lvar catalog generation it was resolved
+	// against, and is re-resolved (lazily, on next use) when the lvars are reloaded.
+	class LvarHandle
+	{
+		friend class ::WASMIF;
+
+	public:
+		LvarHandle();
+		LvarHandle(const char* lvarName); // The name should NOT be prefixed by 'L:'
+		const char* getName();
+		int getId(); // The id as last resolved, or -1 if not (yet) found
+
+	protected:
+
+	private:
+		string name;
+		int id;
+		unsigned int generation; // Catalog generation the id was resolved against. 0 = not resolved
+	};
+} // End of namespace
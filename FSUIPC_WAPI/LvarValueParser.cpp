@@ -0,0 +1,48 @@
+#include "LvarValueParser.h"
+#include <charconv>
+#include <ctype.h>
+
+using namespace std;
+using namespace LvarValueParserMSFS;
+
+
+LVAR_VALUE_TYPE LvarValueParserMSFS::parseLvarValue(const char* value, size_t length, double& number)
+{
+	const char* p = value;
+	const char* end = value + length;
+	number = 0.0;
+	while (p < end && isspace((unsigned char)*p)) p++;
+	while (end > p && isspace((unsigned char)*(end - 1))) end--;
+
+	// from_chars accepts neither a leading '+' nor a "0x" prefix, so the sign and prefix are handled here
+	bool negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+')) p++;
+	if (p == end || *p == '-' || *p == '+') return LVAR_VALUE_STRING;
+	bool hex = end - p > 2 && *p == '0' && (*(p + 1) == 'x' || *(p + 1) == 'X');
+
+	if (!hex) {
+		// Integer?
+		const char* q = p;
+		long long integer = 0;
+		while (q < end && *q >= '0' && *q <= '9' && integer <= 65536) integer = integer * 10 + (*q++ - '0');
+		if (q == end) {
+			if (negative) integer = -integer;
+			if (integer > 0 && integer < 65536) {
+				number = (double)integer;
+				return LVAR_VALUE_UNSIGNED_SHORT;
+			}
+			if (integer > -32769 && integer < 32768) {
+				number = (double)integer;
+				return LVAR_VALUE_SHORT;
+			}
+			// Out of range for a short: fall through and parse as a double
+		}
+	}
+	else p += 2;
+
+	double converted;
+	from_chars_result result = from_chars(p, end, converted, hex ? chars_format::hex : chars_format::general);
+	if (result.ec != errc() || result.ptr != end) return LVAR_VALUE_STRING;
+	number = negative ? -converted : converted;
+	return LVAR_VALUE_DOUBLE;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace LvarValueParserMSFS
+{
+	enum LVAR_VALUE_TYPE
+	{
+		LVAR_VALUE_UNSIGNED_SHORT = 1, // Integer from 1 to 65535
+		LVAR_VALUE_SHORT = 2, // Integer from -32768 to 0
+		LVAR_VALUE_DOUBLE = 3, // Any other number
+		LVAR_VALUE_STRING = 4, // Not a number: sent as (up to) 8 characters packed into a double
+	};
+
+	// Classifies a string lvar value in a single pass and returns its number (0.0 for a string).
+	// Numbers are accepted as by strtod: surrounding whitespace, a leading sign, decimal or
+	// hexadecimal ("0x" prefix) digits, and "inf"/"nan" are allowed.
+	LVAR_VALUE_TYPE parseLvarValue(const char* value, size_t length, double& number);
+} // End of namespace
@@ -0,0 +1,150 @@
+#include "LvarValueStore.h"
+
+using namespace std;
+using namespace LvarValueStoreMSFS;
+
+#define MIN_STORE_CAPACITY		1024
+
+
+LvarValueStore::LvarValueStore()
+{
+	current = allocateBlock(MIN_STORE_CAPACITY);
+	noValues = 0;
+	sequence = 0;
+}
+
+LvarValueStore::~LvarValueStore()
+{
+	freeBlock(current.load());
+	for (ValueBlock* block : retired) freeBlock(block);
+}
+
+LvarValueStore::ValueBlock* LvarValueStore::allocateBlock(size_t capacity)
+{
+	ValueBlock* block = new ValueBlock;
+	block->capacity = capacity;
+	block->values = new atomic<double>[capacity];
+	for (size_t i = 0; i < capacity; i++) block->values[i].store(0.0, memory_order_relaxed);
+	return block;
+}
+
+void LvarValueStore::freeBlock(ValueBlock* block)
+{
+	if (block) {
+		delete[] block->values;
+		delete block;
+	}
+}
+
+void LvarValueStore::growBlock(size_t capacity, size_t noKept)
+{
+	// Readers may still hold the block being replaced, and there is no way to know when they have
+	// all finished with it, so it is kept until the store is destroyed. The capacity at least doubles
+	// each time, so the retired blocks together never take more space than the current one.
+	ValueBlock* block = current.load(memory_order_relaxed);
+	if (capacity < block->capacity * 2) capacity = block->capacity * 2;
+	ValueBlock* newBlock = allocateBlock(capacity);
+	for (size_t i = 0; i < noKept; i++)
+		newBlock->values[i].store(block->values[i].load(memory_order_relaxed), memory_order_relaxed);
+	retired.push_back(block);
+	current.store(newBlock, memory_order_release);
+}
+
+void LvarValueStore::clear(size_t capacity)
+{
+	noValues.store(0, memory_order_release);
+	ValueBlock* block = current.load(memory_order_relaxed);
+	if (capacity > block->capacity) {
+		growBlock(capacity, 0);
+	}
+	else {
+		beginUpdate();
+		for (size_t i = 0; i < block->capacity; i++) block->values[i].store(0.0, memory_order_relaxed);
+		endUpdate();
+	}
+}
+
+void LvarValueStore::reserve(size_t capacity)
+{
+	if (capacity > current.load(memory_order_relaxed)->capacity) growBlock(capacity, noValues.load(memory_order_relaxed));
+}
+
+void LvarValueStore::resize(size_t newSize)
+{
+	ValueBlock* block = current.load(memory_order_relaxed);
+	size_t oldSize = noValues.load(memory_order_relaxed);
+
+	if (newSize > block->capacity) {
+		growBlock(newSize, oldSize);
+	}
+	else {
+		for (size_t i = oldSize; i < newSize; i++) block->values[i].store(0.0, memory_order_relaxed);
+	}
+	// Publish the size after the block so that readers never index past the block they see
+	noValues.store(newSize, memory_order_release);
+}
+
+void LvarValueStore::beginUpdate()
+{
+	sequence.store(sequence.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+void LvarValueStore::setValue(int id, double value)
+{
+	ValueBlock* block = current.load(memory_order_relaxed);
+	if (id < 0 || (size_t)id >= block->capacity) return;
+	block->values[id].store(value, memory_order_relaxed);
+}
+
+void LvarValueStore::endUpdate()
+{
+	sequence.store(sequence.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+size_t LvarValueStore::size()
+{
+	return noValues.load(memory_order_acquire);
+}
+
+double LvarValueStore::getValue(int id)
+{
+	size_t n = noValues.load(memory_order_acquire);
+	ValueBlock* block = current.load(memory_order_acquire);
+	if (id < 0 || (size_t)id >= n || (size_t)id >= block->capacity) return 0.0;
+	return block->values[id].load(memory_order_relaxed);
+}
+
+size_t LvarValueStore::getValues(double* values, size_t maxValues)
+{
+	for (;;) {
+		unsigned long long seqStart = sequence.load(memory_order_acquire);
+		if (seqStart & 1) continue; // Update in progress
+
+		size_t n = noValues.load(memory_order_acquire);
+		ValueBlock* block = current.load(memory_order_acquire);
+		if (n > maxValues) n = maxValues;
+		if (n > block->capacity) n = block->capacity;
+		for (size_t i = 0; i < n; i++) values[i] = block->values[i].load(memory_order_relaxed);
+
+		atomic_thread_fence(memory_order_acquire);
+		if (sequence.load(memory_order_relaxed) == seqStart) return n;
+	}
+}
+
+void LvarValueStore::getValues(const int* ids, double* values, size_t noIds)
+{
+	for (;;) {
+		unsigned long long seqStart = sequence.load(memory_order_acquire);
+		if (seqStart & 1) continue; // Update in progress
+
+		size_t n = noValues.load(memory_order_acquire);
+		ValueBlock* block = current.load(memory_order_acquire);
+		if (n > block->capacity) n = block->capacity;
+		for (size_t i = 0; i < noIds; i++)
+			values[i] = ids[i] >= 0 && (size_t)ids[i] < n ? block->values[ids[i]].load(memory_order_relaxed) : 0.0;
+
+		atomic_thread_fence(memory_order_acquire);
+		if (sequence.load(memory_order_relaxed) == seqStart) return;
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <vector>
+
+using namespace std;
+
+namespace LvarValueStoreMSFS
+{
+	// Lvar value store with lock-free readers.
+	// There is a single writer (the SimConnect thread). Single values are held as atomic
+	// doubles, so getValue never blocks. Writes made between beginUpdate and endUpdate are
+	// covered by a sequence lock so that getValues can take a consistent copy of a whole
+	// CDA update without stopping the writer.
+	class LvarValueStore
+	{
+	public:
+		LvarValueStore();
+		~LvarValueStore();
+
+		// Writer interface - SimConnect thread only
+		void clear(size_t capacity); // Drops all values and pre-allocates storage for capacity values
+		void reserve(size_t capacity); // Pre-allocates storage for capacity values, keeping the current values
+		void resize(size_t noValues); // Sets the number of values. New values are set to 0.0
+		void beginUpdate();
+		void setValue(int id, double value);
+		void endUpdate();
+
+		// Reader interface - any thread
+		size_t size();
+		double getValue(int id); // Returns 0.0 if the id is out of range
+		size_t getValues(double* values, size_t maxValues); // Consistent copy of the first maxValues values. Returns the number copied
+		void getValues(const int* ids, double* values, size_t noIds); // Consistent copy of the values of the given ids. Unknown ids give 0.0
+
+	protected:
+
+	private:
+		typedef struct _ValueBlock
+		{
+			size_t capacity;
+			atomic<double>* values;
+		} ValueBlock;
+
+		ValueBlock* allocateBlock(size_t capacity);
+		void freeBlock(ValueBlock* block);
+		void growBlock(size_t capacity, size_t noKept);
+
+		atomic<ValueBlock*> current;
+		vector<ValueBlock*> retired; // Replaced blocks, kept until the store is destroyed as readers may still hold them
+		atomic<size_t> noValues;
+		atomic<unsigned long long> sequence; // Odd while an update is in progress
+	};
+} // End of namespace
@@ -0,0 +1,120 @@
+#include "TimerScheduler.h"
+#include <climits>
+
+using namespace std;
+using namespace TimerSchedulerMSFS;
+
+
+TimerScheduler::TimerScheduler()
+{
+	nextId = 1;
+	QueryPerformanceFrequency(&performanceFrequency);
+	InitializeCriticalSection(&timerMutex);
+}
+
+TimerScheduler::~TimerScheduler()
+{
+	DeleteCriticalSection(&timerMutex);
+}
+
+int TimerScheduler::add(int interval, function<void()> callback, bool repeat)
+{
+	EnterCriticalSection(&timerMutex);
+	int id = nextId++;
+	TIMER& timer = timers[id];
+	timer.interval = interval > 0 ? interval : 1;
+	timer.repeat = repeat;
+	timer.deadline = GetTickCount64() + timer.interval;
+	timer.lastFired = 0;
+	timer.callback = callback;
+	LeaveCriticalSection(&timerMutex);
+	return id;
+}
+
+void TimerScheduler::remove(int id)
+{
+	EnterCriticalSection(&timerMutex);
+	timers.erase(id);
+	LeaveCriticalSection(&timerMutex);
+}
+
+void TimerScheduler::setInterval(int id, int interval)
+{
+	EnterCriticalSection(&timerMutex);
+	auto it = timers.find(id);
+	if (it != timers.end()) {
+		it->second.interval = interval > 0 ? interval : 1;
+		it->second.lastFired = 0; // Don't record the change as jitter
+		ULONGLONG deadline = GetTickCount64() + it->second.interval;
+		if (deadline < it->second.deadline) it->second.deadline = deadline;
+	}
+	LeaveCriticalSection(&timerMutex);
+}
+
+void TimerScheduler::clear()
+{
+	EnterCriticalSection(&timerMutex);
+	timers.clear();
+	LeaveCriticalSection(&timerMutex);
+}
+
+ULONGLONG TimerScheduler::getNextDeadline()
+{
+	ULONGLONG deadline = ULLONG_MAX;
+	EnterCriticalSection(&timerMutex);
+	for (auto& timer : timers) {
+		if (timer.second.deadline < deadline) deadline = timer.second.deadline;
+	}
+	LeaveCriticalSection(&timerMutex);
+	return deadline;
+}
+
+void TimerScheduler::run()
+{
+	ULONGLONG now = GetTickCount64();
+	LARGE_INTEGER counter;
+
+	// Fire one timer at a time, outside the lock, as the callbacks may add or remove timers
+	for (;;) {
+		function<void()> callback;
+		EnterCriticalSection(&timerMutex);
+		auto due = timers.end();
+		for (auto it = timers.begin(); it != timers.end(); it++) {
+			if (it->second.deadline <= now && (due == timers.end() || it->second.deadline < due->second.deadline)) due = it;
+		}
+		if (due == timers.end()) {
+			LeaveCriticalSection(&timerMutex);
+			break;
+		}
+		TIMER& timer = due->second;
+		callback = timer.callback;
+		if (timer.repeat) {
+			QueryPerformanceCounter(&counter);
+			if (timer.lastFired && performanceFrequency.QuadPart) {
+				LONGLONG elapsed = (counter.QuadPart - timer.lastFired) * 1000000 / performanceFrequency.QuadPart;
+				LONGLONG deviation = elapsed - (LONGLONG)timer.interval * 1000;
+				timer.jitter.record(deviation < 0 ? -deviation : deviation);
+			}
+			timer.lastFired = counter.QuadPart;
+			// Keep to the schedule, unless we have fallen more than an interval behind
+			timer.deadline += timer.interval;
+			if (timer.deadline <= now) timer.deadline = now + timer.interval;
+		}
+		else timers.erase(due);
+		LeaveCriticalSection(&timerMutex);
+		callback();
+	}
+}
+
+bool TimerScheduler::getJitter(int id, unsigned long long counts[LatencyHistogram::NO_BUCKETS])
+{
+	bool found = false;
+	EnterCriticalSection(&timerMutex);
+	auto it = timers.find(id);
+	if (it != timers.end()) {
+		it->second.jitter.getCounts(counts);
+		found = true;
+	}
+	LeaveCriticalSection(&timerMutex);
+	return found;
+}
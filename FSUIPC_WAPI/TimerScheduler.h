@@ -0,0 +1,51 @@
+#pragma once
+
+#include <windows.h>
+#include <map>
+#include <functional>
+#include "LatencyHistogram.h"
+
+using namespace std;
+using namespace LatencyHistogramMSFS;
+
+namespace TimerSchedulerMSFS
+{
+	// Deadline queue of (repeating) timers, run from the SimConnect thread so that no HWND or
+	// message loop is needed. The owning thread waits until getNextDeadline, then calls run.
+	// Each timer records the jitter of its interval (difference between the actual and set
+	// interval between firings) in microseconds.
+	class TimerScheduler
+	{
+	public:
+		TimerScheduler();
+		~TimerScheduler();
+
+		int add(int interval, function<void()> callback, bool repeat = true); // interval in ms. Returns the timer id (never 0)
+		void remove(int id);
+		void setInterval(int id, int interval); // A shorter interval brings the next firing forward, a longer one takes effect after the next firing
+		void clear();
+
+		ULONGLONG getNextDeadline(); // GetTickCount64 time of the next firing, or ULLONG_MAX if none
+		void run(); // Fires all due timers, in deadline order
+
+		bool getJitter(int id, unsigned long long counts[LatencyHistogram::NO_BUCKETS]); // Returns false if no such timer
+
+	protected:
+
+	private:
+		typedef struct _TIMER
+		{
+			int interval;
+			bool repeat;
+			ULONGLONG deadline;
+			LONGLONG lastFired; // Performance counter, 0 if not yet fired
+			function<void()> callback;
+			LatencyHistogram jitter;
+		} TIMER;
+
+		map<int, TIMER> timers;
+		int nextId;
+		LARGE_INTEGER performanceFrequency;
+		CRITICAL_SECTION timerMutex;
+	};
+} // End of namespace
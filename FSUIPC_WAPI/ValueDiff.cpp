@@ -0,0 +1,93 @@
+#include "ValueDiff.h"
+#include <string.h>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <immintrin.h>
+#define VALUEDIFF_SIMD
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+using namespace ValueDiffMSFS;
+
+#ifdef VALUEDIFF_SIMD
+static bool cpuHasAVX2()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+	__cpuid(info, 1);
+	// OSXSAVE and AVX, and the OS must be saving the YMM registers
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return false;
+	if ((_xgetbv(0) & 6) != 6) return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static const bool useAVX2 = cpuHasAVX2();
+
+TARGET_AVX2 static unsigned long long diffWordAVX2(const double* previous, const double* incoming)
+{
+	unsigned long long bits = 0;
+	for (int i = 0; i < 64; i += 4) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)(previous + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(incoming + i));
+		unsigned int equal = (unsigned int)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, b)));
+		bits |= (unsigned long long)(equal ^ 0xF) << i;
+	}
+	return bits;
+}
+
+static unsigned long long diffWordSSE2(const double* previous, const double* incoming)
+{
+	unsigned long long bits = 0;
+	for (int i = 0; i < 64; i += 2) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(previous + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(incoming + i));
+		// SSE2 has no 64-bit compare: both 32-bit halves must be equal
+		__m128i equal32 = _mm_cmpeq_epi32(a, b);
+		__m128i equal64 = _mm_and_si128(equal32, _mm_shuffle_epi32(equal32, _MM_SHUFFLE(2, 3, 0, 1)));
+		unsigned int equal = (unsigned int)_mm_movemask_pd(_mm_castsi128_pd(equal64));
+		bits |= (unsigned long long)(equal ^ 0x3) << i;
+	}
+	return bits;
+}
+#endif
+
+static unsigned long long diffScalar(const double* previous, const double* incoming, size_t noValues)
+{
+	unsigned long long bits = 0;
+	for (size_t i = 0; i < noValues; i++) {
+		unsigned long long a, b;
+		memcpy(&a, previous + i, sizeof(a));
+		memcpy(&b, incoming + i, sizeof(b));
+		if (a != b) bits |= 1ULL << i;
+	}
+	return bits;
+}
+
+bool ValueDiffMSFS::diffValues(const double* previous, const double* incoming, size_t noValues, unsigned long long* changedMask)
+{
+	unsigned long long anyChanged = 0;
+	size_t word = 0;
+	size_t i = 0;
+
+#ifdef VALUEDIFF_SIMD
+	for (; i + 64 <= noValues; i += 64, word++) {
+		changedMask[word] = useAVX2 ? diffWordAVX2(previous + i, incoming + i) : diffWordSSE2(previous + i, incoming + i);
+		anyChanged |= changedMask[word];
+	}
+#endif
+	for (; i < noValues; i += 64, word++) {
+		changedMask[word] = diffScalar(previous + i, incoming + i, noValues - i < 64 ? noValues - i : 64);
+		anyChanged |= changedMask[word];
+	}
+	return anyChanged != 0;
+}
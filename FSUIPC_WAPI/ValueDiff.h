@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace ValueDiffMSFS
+{
+	// Compares a block of incoming lvar values against the previous block, bit for bit, and sets
+	// bit i of changedMask (which must hold (noValues+63)/64 words) when value i has changed.
+	// Uses AVX2 or SSE2 when available, with a scalar fallback. Returns true if any value changed.
+	bool diffValues(const double* previous, const double* incoming, size_t noValues, unsigned long long* changedMask);
+
+	// Returns the index of the lowest set bit. The argument must not be 0
+	inline int lowestSetBit(unsigned long long bits)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		unsigned long index;
+		_BitScanForward64(&index, bits);
+		return (int)index;
+#elif defined(_MSC_VER)
+		unsigned long index;
+		if (_BitScanForward(&index, (unsigned long)bits)) return (int)index;
+		_BitScanForward(&index, (unsigned long)(bits >> 32));
+		return (int)index + 32;
+#else
+		return __builtin_ctzll(bits);
+#endif
+	}
+} // End of namespace
@@ -0,0 +1,162 @@
+#include "VarNameIndex.h"
+
+using namespace std;
+using namespace VarNameIndexMSFS;
+
+#define MIN_INDEX_SLOTS		256
+
+
+VarNameIndex::VarNameIndex(vector<string>& names) : names(names)
+{
+	noEntries = 0;
+	mask = 0;
+	InitializeSRWLock(&lock);
+}
+
+void VarNameIndex::clear()
+{
+	AcquireSRWLockExclusive(&lock);
+	names.clear();
+	slots.clear();
+	slotHashes.clear();
+	noEntries = 0;
+	mask = 0;
+	ReleaseSRWLockExclusive(&lock);
+}
+
+void VarNameIndex::reserve(size_t noNames)
+{
+	AcquireSRWLockExclusive(&lock);
+	names.reserve(noNames);
+	// Keep the load factor at or below 0.5
+	if (noNames * 2 > slots.size()) grow(noNames * 2);
+	ReleaseSRWLockExclusive(&lock);
+}
+
+void VarNameIndex::resize(size_t noNames)
+{
+	AcquireSRWLockExclusive(&lock);
+	bool shrinking = noNames < names.size();
+	names.resize(noNames);
+	if (shrinking) rebuild();
+	ReleaseSRWLockExclusive(&lock);
+}
+
+void VarNameIndex::setName(int id, const char* name, size_t length)
+{
+	if (id < 0) return;
+	AcquireSRWLockExclusive(&lock);
+	if (id >= (int)names.size()) names.resize((size_t)id + 1);
+	else remove(id);
+	names[id].assign(name, length);
+	add(id);
+	ReleaseSRWLockExclusive(&lock);
+}
+
+void VarNameIndex::add(int id)
+{
+	if ((noEntries + 1) * 2 > slots.size()) grow((noEntries + 1) * 2);
+
+	string_view name(names[id]);
+	unsigned int h = hash(name);
+	size_t slot = h & mask;
+	while (slots[slot] >= 0) {
+		// Keep the first id for duplicate names, as the previous linear scan did
+		if (slotHashes[slot] == h && names[slots[slot]] == name) {
+			if (slots[slot] > id) slots[slot] = id;
+			return;
+		}
+		slot = (slot + 1) & mask;
+	}
+	slots[slot] = id;
+	slotHashes[slot] = h;
+	noEntries++;
+}
+
+void VarNameIndex::remove(int id)
+{
+	// Removes the entry for the name currently held at id, if it is indexed under this id
+	if (!noEntries) return;
+	unsigned int h = hash(names[id]);
+	size_t slot = h & mask;
+	while (slots[slot] != id) {
+		if (slots[slot] < 0) return;
+		slot = (slot + 1) & mask;
+	}
+
+	// Shift back any following entries that would no longer be reachable across the gap
+	size_t gap = slot;
+	for (size_t next = (gap + 1) & mask; slots[next] >= 0; next = (next + 1) & mask) {
+		size_t home = slotHashes[next] & mask;
+		if (((next - home) & mask) >= ((next - gap) & mask)) {
+			slots[gap] = slots[next];
+			slotHashes[gap] = slotHashes[next];
+			gap = next;
+		}
+	}
+	slots[gap] = -1;
+	slotHashes[gap] = 0;
+	noEntries--;
+}
+
+void VarNameIndex::rebuild()
+{
+	slots.assign(slots.size(), -1);
+	slotHashes.assign(slotHashes.size(), 0);
+	noEntries = 0;
+	for (size_t id = 0; id < names.size(); id++) add((int)id);
+}
+
+int VarNameIndex::find(string_view name) const
+{
+	int id = -1;
+	AcquireSRWLockShared(&lock);
+	if (noEntries) {
+		unsigned int h = hash(name);
+		size_t slot = h & mask;
+		while (slots[slot] >= 0) {
+			if (slotHashes[slot] == h && names[slots[slot]] == name) {
+				id = slots[slot];
+				break;
+			}
+			slot = (slot + 1) & mask;
+		}
+	}
+	ReleaseSRWLockShared(&lock);
+	return id;
+}
+
+unsigned int VarNameIndex::hash(string_view name)
+{
+	// FNV-1a
+	unsigned int h = 2166136261u;
+	for (char c : name) {
+		h ^= (unsigned char)c;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+void VarNameIndex::grow(size_t minSlots)
+{
+	size_t noSlots = MIN_INDEX_SLOTS;
+	while (noSlots < minSlots) noSlots <<= 1;
+	if (noSlots <= slots.size()) return;
+
+	vector<int> oldSlots;
+	oldSlots.swap(slots);
+	slots.assign(noSlots, -1);
+	slotHashes.assign(noSlots, 0);
+	mask = noSlots - 1;
+	noEntries = 0;
+
+	for (int id : oldSlots) {
+		if (id < 0) continue;
+		unsigned int h = hash(names[id]);
+		size_t slot = h & mask;
+		while (slots[slot] >= 0) slot = (slot + 1) & mask;
+		slots[slot] = id;
+		slotHashes[slot] = h;
+		noEntries++;
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <windows.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace VarNameIndexMSFS
+{
+	// Name to id index for lvar/hvar names. This is an open-addressing (linear probing)
+	// hash table that holds only ids - the names themselves stay in the vector owned
+	// by WASMIF, so no strings are copied or allocated on lookup.
+	// The names vector is changed only through the index, under an exclusive lock, so that
+	// find can be called from any thread while names are received on the SimConnect thread.
+	class VarNameIndex
+	{
+	public:
+		VarNameIndex(vector<string>& names);
+
+		// Writer interface - SimConnect thread only
+		void clear();
+		void reserve(size_t noNames); // Pre-size the names vector and the table for the expected number of names
+		void resize(size_t noNames); // Resizes the names vector. Names dropped are removed from the index
+		void setName(int id, const char* name, size_t length); // Sets (and indexes) the name with the given id, replacing any previous name
+
+		// Reader interface - any thread
+		int find(string_view name) const; // Returns the id of the name, or -1 if not found
+
+	protected:
+
+	private:
+		static unsigned int hash(string_view name);
+		void grow(size_t minSlots);
+		void add(int id);
+		void remove(int id);
+		void rebuild();
+
+		vector<string>& names;
+		vector<int> slots; // id, or -1 if empty
+		vector<unsigned int> slotHashes;
+		size_t noEntries;
+		size_t mask;
+		mutable SRWLOCK lock;
+	};
+} // End of namespace
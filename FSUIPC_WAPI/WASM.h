@@ -3,16 +3,37 @@
  * Main WASM Interface. This is the file that is shared
  * between the WASM module and the Client.
  */
-#define WASM_VERSION			"0.5.5"
+#define WASM_VERSION			"0.6.0"
 #define MAX_VAR_NAME_SIZE		56 // Max size of a CDA is 8k. So Max no lvars per CDK is 8192/(this valuw) = 146
 #define MAX_CDA_NAME_SIZE		64 
-#define MAX_NO_VALUE_CDAS		2 // Allows for 2*1024 lvars 
-#define MAX_NO_LVAR_CDAS		14 // 14 is max and allows for 2044 lvars - the max allowd for the 2 value areas (8k/8) is 2048
+#define MAX_NO_VALUE_CDAS		8 // Allows for 8*1024 lvars
+#define MAX_NO_LVAR_CDAS		57 // Allows for 57*146 = 8322 lvars names, enough for the 8192 lvars the value areas can hold
 #define MAX_NO_HVAR_CDAS		4 // We can have more of these if needed
 #define CONFIG_CDA_NAME			"FSUIPC_config"
 #define LVARVALUE_CDA_NAME		"FSUIPC_SetLvar"
+#define LVARVALUES_CDA_NAME		"FSUIPC_SetLvars"
+#define HVARS_CDA_NAME			"FSUIPC_SetHvars"
 #define CCODE_CDA_NAME			"FSUIPC_CalcCode"
+#define CCODEREG_CDA_NAME		"FSUIPC_RegCalcCode"
+#define CCODEEXEC_CDA_NAME		"FSUIPC_ExecCalcCode"
+#define CCODEBATCH_CDA_NAME		"FSUIPC_CalcCodeBatch"
 #define MAX_CALC_CODE_SIZE		256 // Up to 8k
+#define MAX_CALC_CODE_BATCH_SIZE	8184 // 8192 - 8: max size of the (nul-terminated) scripts in one write of the calc code batch CDA
+#define MAX_REG_CALC_CODE_SIZE	8184 // 8192 - 8: max size of the (nul-terminated) code in one write of the register calc code CDA
+#define MAX_NO_DELTA_ITEMS		682 // (8192 - 4)/12: max no of (id, value) pairs in a delta CDA
+#define MAX_NO_SET_LVARS		682 // (8192 - 8)/12: max no of lvars set in one write of the set lvars CDA
+#define MAX_NO_SET_HVARS		254 // (1024 - 8)/4: max no of hvars activated in one write of the set hvars CDA
+#define MAX_NO_CALC_CODE_PARAMS	8 // Parameters are set in lvars FSUIPC_CalcParam0 to FSUIPC_CalcParam7 before registered calc code is executed
+
+ // Protocol flags. The client sends the flags it supports with the Set Protocol event,
+ // and the WASM returns the flags in use in the config CDA
+#define PROTOCOL_DELTA_VALUES	0x0001 // Value updates are sent as (id, value) pairs in a DELTAF CDA, full value CDAs only on (re)load
+#define PROTOCOL_SET_LVARS		0x0002 // The WASM creates the LVARVALUES_CDA_NAME CDA, to set multiple lvars in one write
+#define PROTOCOL_WRITE_SEQUENCE	0x0004 // The WASM creates the set lvar and calc code CDAs with the CDASETLVARSEQ and CDACALCCODESEQ layouts, and uses the sequence number of these (and the other set/calc code) writes to detect a repeated write, so no clearing write is needed
+#define PROTOCOL_SET_HVARS		0x0008 // The WASM creates the HVARS_CDA_NAME CDA, to activate multiple hvars (in order) in one write
+#define PROTOCOL_CALC_CODE_HANDLES	0x0010 // The WASM creates the CCODEREG_CDA_NAME and CCODEEXEC_CDA_NAME CDAs, to register calc code and execute it by handle
+#define PROTOCOL_CALC_CODE_BATCH	0x0020 // The WASM creates the CCODEBATCH_CDA_NAME CDA, to execute one or more scripts (of up to MAX_CALC_CODE_BATCH_SIZE) in one write
+#define PROTOCOL_INCREMENTAL_RELOAD	0x0040 // On reload, the WASM keeps the CDAs whose name, size and type are unchanged, and only writes the name CDAs whose contents have changed
 
  // Define the default value where our events start. From this:
  //    0 = Get Config Data (provided but shouldn't be needed)
@@ -22,6 +43,8 @@
  //   +4 = Request to List LVARS (generates aircraft LVAR file)
  //   +5 = Reload Control: scans for lvars and re-reads hvar files and drops and re-creates all CDAs accordingly
 //    +6 = Set LVAR (signed short values): parameter contains LVAR ID in low word and encoded value in hi word
+//    +7 = Set Protocol: parameter contains the PROTOCOL_ flags supported by the client
+//    +8 = Execute Registered Calculator Code: parameter contains the handle of the code, which is executed without parameters
  // Note that it should be possible to change this value (via an ini parameter)
  // in both the WASM module and any clients. They must, of course, match.
 #define EVENT_START_NO			0x1FFF0
@@ -34,11 +57,66 @@ namespace WASM {
 		double lvarValue;
 	} CDASETLVAR;
 
+	typedef struct _CDASETLVARSEQ // Layout of the LVARVALUE_CDA_NAME CDA when PROTOCOL_WRITE_SEQUENCE is in use
+	{
+		int id;
+		double lvarValue;
+		unsigned int sequence; // Incremented on each write
+	} CDASETLVARSEQ;
+
+	typedef struct _CDALvarValue
+	{
+		int id;
+		double value;
+	} CDALvarValue;
+
+	typedef struct _CDASETLVARS
+	{
+		int noItems;
+		unsigned int sequence; // Incremented on each write
+		CDALvarValue lvars[MAX_NO_SET_LVARS];
+	} CDASETLVARS;
+
+	typedef struct _CDASETHVARS
+	{
+		int noItems;
+		unsigned int sequence; // Incremented on each write
+		int ids[MAX_NO_SET_HVARS]; // Activated in this order
+	} CDASETHVARS;
+
 	typedef struct _CDACALCCODE
 	{
 		char calcCode[MAX_CALC_CODE_SIZE];
 	} CDACALCCODE;
 
+	typedef struct _CDACALCCODESEQ // Layout of the CCODE_CDA_NAME CDA when PROTOCOL_WRITE_SEQUENCE is in use
+	{
+		char calcCode[MAX_CALC_CODE_SIZE];
+		unsigned int sequence; // Incremented on each write
+	} CDACALCCODESEQ;
+
+	typedef struct _CDACALCCODEBATCH
+	{
+		int noItems;
+		unsigned int sequence; // Incremented on each write
+		char calcCode[MAX_CALC_CODE_BATCH_SIZE]; // noItems nul-terminated scripts, one after the other. Executed in this order
+	} CDACALCCODEBATCH;
+
+	typedef struct _CDAREGCALCCODE
+	{
+		int handle; // Allocated by the client. Registrations are dropped on reload, so are sent again with the same handle
+		unsigned int sequence; // Incremented on each write
+		char calcCode[MAX_REG_CALC_CODE_SIZE]; // Empty to unregister the handle
+	} CDAREGCALCCODE;
+
+	typedef struct _CDAEXECCALCCODE
+	{
+		int handle;
+		unsigned int sequence; // Incremented on each write
+		int noParams;
+		double params[MAX_NO_CALC_CODE_PARAMS];
+	} CDAEXECCALCCODE;
+
 	typedef struct _CDAName
 	{
 		char name[MAX_VAR_NAME_SIZE];
@@ -49,8 +127,14 @@ namespace WASM {
 		double value;
 	} CDAValue;
 
+	typedef struct _CDADELTA
+	{
+		int noItems;
+		CDALvarValue items[MAX_NO_DELTA_ITEMS];
+	} CDADELTA;
+
 	typedef enum {
-		LVARF, HVARF, VALUEF
+		LVARF, HVARF, VALUEF, DELTAF
 	} CDAType;
 
 	typedef struct _CONFIG_CDA
@@ -59,6 +143,7 @@ namespace WASM {
 		char CDA_Names[MAX_NO_LVAR_CDAS + MAX_NO_HVAR_CDAS + MAX_NO_VALUE_CDAS][MAX_CDA_NAME_SIZE];
 		int CDA_Size[MAX_NO_LVAR_CDAS + MAX_NO_HVAR_CDAS + MAX_NO_VALUE_CDAS];
 		CDAType CDA_Type[MAX_NO_LVAR_CDAS + MAX_NO_HVAR_CDAS + MAX_NO_VALUE_CDAS];
+		int protocolFlags; // PROTOCOL_ flags in use
 	} CONFIG_CDA;
 }
 #pragma pack(pop)
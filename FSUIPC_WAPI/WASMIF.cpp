@@ -3,10 +3,16 @@
 #include <sstream>
 #include <iomanip>
 #include <cmath>
+#include <climits>
+#define LOGGER_INSTANCE logger // Log to the logger of this instance
 #include "Logger.h"
+#include "ValueDiff.h"
+#include "LvarValueParser.h"
 
 
 using namespace CPlusPlusLogging;
+using namespace ValueDiffMSFS;
+using namespace LvarValueParserMSFS;
 
 enum WASM_EVENT_ID {
 	// Events we send
@@ -16,30 +22,87 @@ enum WASM_EVENT_ID {
 	EVENT_LIST_LVARS,		// map to StartEventNo + 4, used to generate lvar files. Depracated
 	EVENT_RELOAD,			// map to StartEventNo + 5, used to reload lvars/hvars and re-create the CDAs
 	EVENT_SET_LVARS,		// map to StartEventNo + 6, used to set signed shorts via SimConnect
+	EVENT_SET_PROTOCOL,		// map to StartEventNo + 7, used to tell the WASM which protocol flags we support
+	EVENT_EXEC_CALC_CODE,	// map to StartEventNo + 8, used to execute registered calculator code without parameters
 	// Events we receive
 	EVENT_CONFIG_RECEIVED = 9,  // Config data received from the WASM, giving details of CDAs and sizes required
-	EVENT_VALUES_RECEIVED = 10, // Start event number of events received when an lvar value CDA have been updated. Allow for MAX_NO_VALUE_CDAS (2)
-	EVENT_LVARS_RECEIVED = 12, // Start event number of events received when an lvar name CDA have been updated. Allow for MAX_NO_LVAR_CDAS (12)
-	EVENT_HVARS_RECEIVED = 30, // Start event number of events received when an hvar name CDA have been updated. Allow for MAX_NO_HVAR_CDAS (4)
+	EVENT_VALUES_RECEIVED = 10, // Start event number of events received when an lvar value CDA have been updated. Allow for MAX_NO_VALUE_CDAS
+	EVENT_LVARS_RECEIVED = EVENT_VALUES_RECEIVED + MAX_NO_VALUE_CDAS, // Start event number of events received when an lvar name CDA have been updated. Allow for MAX_NO_LVAR_CDAS
+	EVENT_HVARS_RECEIVED = EVENT_LVARS_RECEIVED + MAX_NO_LVAR_CDAS, // Start event number of events received when an hvar name CDA have been updated. Allow for MAX_NO_HVAR_CDAS
+	EVENT_DELTAS_RECEIVED = EVENT_HVARS_RECEIVED + MAX_NO_HVAR_CDAS, // Event received when the lvar delta CDA has been updated
+};
+
+enum LVAR_UPDATE_TARGET {
+	TARGET_CALLBACKS = 1,	// lvar flagged for the lvar update callbacks (and passed any deadband)
+	TARGET_SUBSCRIBERS = 2,	// lvar has subscribers
 };
 
 WASMIF* WASMIF::m_Instance = 0;
-int WASMIF::nextDefinitionID = 1; // 1 taken by config CDA
-Logger* pLogger = nullptr;
+atomic<int> WASMIF::noInstances = 0;
 
 
-WASMIF::WASMIF() {
+WASMIF::WASMIF() : lvarChanges(LVAR_CHANGE_JOURNAL_SIZE), lvarNameIndex(lvarNames), hvarNameIndex(hvarNames) {
 	hSimConnect = NULL;
+	cdaIdBank = NULL;
+	logger = nullptr;
+	ownsLogger = false;
+	lvarNameSnapshot = make_shared<const vector<string>>();
+	nextDefinitionID = 1; // 1 taken by config CDA
+	noLvarCDAsReceived = 0;
+	protocolFlags = 0;
+	writeSequence = 0;
+	writeQueueing = false;
+	writeConnection = false;
+	writeQuit = 0;
+	writeFlushInterval = 0;
+	nextWriteFlush = 0;
+	writesSent = 0;
+	noPendingSets = 0;
+	setTimeouts = 0;
+	InitializeCriticalSection(&pendingSetMutex);
+	InitializeCriticalSection(&calcCodeMutex);
+	InitializeCriticalSection(&writeBufferMutex);
+	nextCalcCodeHandle = 0;
+	QueryPerformanceFrequency(&performanceFrequency);
+	updateCallbacks = false;
+	updateSubscriptions = false;
 	configTimer = 0;
 	quit = 0;
 	noLvarCDAs = 0;
 	noHvarCDAs = 0;
 	lvarUpdateFrequency = 0;
-	InitializeCriticalSection(&lvarMutex);
+	minLvarUpdateFrequency = 0;
+	lvarChangeThreshold = ADAPTIVE_CHANGE_THRESHOLD;
+	maxLvarUpdateFrequency = 0;
+	lvarUpdateFrequencyChanged = false;
+	lvarChangesSinceRequest = 0;
+	staticLvarRequests = 0;
+	lvarCatalogGeneration = 1;
+	callbackDelivery = CALLBACK_DELIVERY_INLINE;
+	callbackOverflow = CALLBACK_OVERFLOW_COALESCE;
+	callbackQueueSize = CALLBACK_QUEUE_SIZE;
+	callbackQuit = 0;
+	cdaCallbackPending = false;
+	InitializeCriticalSection(&lvarFlagMutex);
+	InitializeCriticalSection(&callbackDeliveryMutex);
+	InitializeCriticalSection(&subscriptionMutex);
+	nextSubscriptionToken = 1;
+	hasLvarSubscriptions = false;
+	lvarSubscriptionsChanged = false;
 	simConnection = SIMCONNECT_OPEN_CONFIGINDEX_LOCAL; // = -1
+	hWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
 }
 
-WASMIF::~WASMIF() {}
+WASMIF::~WASMIF() {
+	if (hWakeEvent) CloseHandle(hWakeEvent);
+	DeleteCriticalSection(&pendingSetMutex);
+	DeleteCriticalSection(&calcCodeMutex);
+	DeleteCriticalSection(&writeBufferMutex);
+	DeleteCriticalSection(&lvarFlagMutex);
+	DeleteCriticalSection(&callbackDeliveryMutex);
+	DeleteCriticalSection(&subscriptionMutex);
+	if (ownsLogger) Logger::destroyInstance(logger);
+}
 
 void WASMIF::setSimConfigConnection(int connection) {
 	simConnection = connection;
@@ -53,10 +116,10 @@ WASMIF* WASMIF::GetInstance(HWND hWnd, int startEventNo, void (*loggerFunction)(
 		m_Instance->hWnd = hWnd;
 		m_Instance->startEventNo = startEventNo;
 		if (loggerFunction == nullptr) {
-			pLogger = Logger::getInstance(".\\FSUIPC_WASMIF");
+			m_Instance->logger = Logger::getInstance(".\\FSUIPC_WASMIF");
 		}
 		else {
-			pLogger = Logger::getInstance(loggerFunction);
+			m_Instance->logger = Logger::getInstance(loggerFunction);
 		}
     }
     return m_Instance;
@@ -70,10 +133,10 @@ WASMIF* WASMIF::GetInstance(HWND hWnd, void (*loggerFunction)(const char* logStr
 		m_Instance->hWnd = hWnd;
 		m_Instance->startEventNo = EVENT_START_NO;
 		if (loggerFunction == nullptr) {
-			pLogger = Logger::getInstance(".\\FSUIPC_WASMIF");
+			m_Instance->logger = Logger::getInstance(".\\FSUIPC_WASMIF");
 		}
 		else {
-			pLogger = Logger::getInstance(loggerFunction);
+			m_Instance->logger = Logger::getInstance(loggerFunction);
 		}
 		m_Instance->lvarUpdateFrequency = 0;
 	}
@@ -81,8 +144,42 @@ WASMIF* WASMIF::GetInstance(HWND hWnd, void (*loggerFunction)(const char* logStr
 }
 
 
+WASMIF* WASMIF::CreateInstance(HWND hWnd, int startEventNo, void (*loggerFunction)(const char* logString)) {
+	WASMIF* instance = new WASMIF();
+	int instanceNo = ++noInstances;
+	instance->hWnd = hWnd;
+	instance->startEventNo = startEventNo;
+	instance->ownsLogger = true;
+	if (loggerFunction == nullptr) {
+		string logFileName = ".\\FSUIPC_WASMIF_" + to_string(instanceNo);
+		instance->logger = Logger::createInstance(logFileName.c_str());
+	}
+	else {
+		instance->logger = Logger::createInstance(loggerFunction);
+	}
+	return instance;
+}
+
+
+void WASMIF::DestroyInstance(WASMIF* instance) {
+	if (instance == NULL) return;
+	// Ending the SimConnect thread also stops the write and callback threads and closes the connections
+	HANDLE thread = instance->hThread;
+	if (thread) {
+		instance->end();
+		if (WaitForSingleObject(thread, 5000) != WAIT_OBJECT_0) {
+			instance->logger->error("SimConnect thread did not end: instance not destroyed");
+			return;
+		}
+		CloseHandle(thread);
+	}
+	if (instance == m_Instance) m_Instance = 0;
+	delete instance;
+}
+
+
 void WASMIF::setLogLevel(LOGLEVEL logLevel) {
-	pLogger->updateLogLevel((LogLevel)logLevel);
+	logger->updateLogLevel((LogLevel)logLevel);
 }
 
 
@@ -95,65 +192,158 @@ const char* WASMIF::getEventString(int eventNo) {
 }
 
 
-DWORD WINAPI WASMIF::SimConnectStart() {
+void WASMIF::mapEventsAndCDAs(HANDLE hConnection, int& CDAId, int& definitionId) {
+	// Maps our events and the fixed CDAs. Also used for the write connection, so that the ids used by the writes are the same on both connections
 	HRESULT hr;
-	int CDAId = 1;
-	nextDefinitionID = 1;
 
-//	hr = SimConnect_MapClientEventToSimEvent(hSimConnect, EVENT_GET_CONFIG, getEventString(EVENT_GET_CONFIG));
-	hr = SimConnect_MapClientEventToSimEvent(hSimConnect, EVENT_SET_LVAR, getEventString(EVENT_SET_LVAR));
-	hr = SimConnect_MapClientEventToSimEvent(hSimConnect, EVENT_SET_HVAR, getEventString(EVENT_SET_HVAR));
-	hr = SimConnect_MapClientEventToSimEvent(hSimConnect, EVENT_UPDATE_CDAS, getEventString(EVENT_UPDATE_CDAS));
-	hr = SimConnect_MapClientEventToSimEvent(hSimConnect, EVENT_LIST_LVARS, getEventString(EVENT_LIST_LVARS));
-	hr = SimConnect_MapClientEventToSimEvent(hSimConnect, EVENT_RELOAD, getEventString(EVENT_RELOAD));
-	hr = SimConnect_MapClientEventToSimEvent(hSimConnect, EVENT_SET_LVARS, getEventString(EVENT_SET_LVARS));
+//	hr = SimConnect_MapClientEventToSimEvent(hConnection, EVENT_GET_CONFIG, getEventString(EVENT_GET_CONFIG));
+	hr = SimConnect_MapClientEventToSimEvent(hConnection, EVENT_SET_LVAR, getEventString(EVENT_SET_LVAR));
+	hr = SimConnect_MapClientEventToSimEvent(hConnection, EVENT_SET_HVAR, getEventString(EVENT_SET_HVAR));
+	hr = SimConnect_MapClientEventToSimEvent(hConnection, EVENT_UPDATE_CDAS, getEventString(EVENT_UPDATE_CDAS));
+	hr = SimConnect_MapClientEventToSimEvent(hConnection, EVENT_LIST_LVARS, getEventString(EVENT_LIST_LVARS));
+	hr = SimConnect_MapClientEventToSimEvent(hConnection, EVENT_RELOAD, getEventString(EVENT_RELOAD));
+	hr = SimConnect_MapClientEventToSimEvent(hConnection, EVENT_SET_LVARS, getEventString(EVENT_SET_LVARS));
+	hr = SimConnect_MapClientEventToSimEvent(hConnection, EVENT_SET_PROTOCOL, getEventString(EVENT_SET_PROTOCOL));
+	hr = SimConnect_MapClientEventToSimEvent(hConnection, EVENT_EXEC_CALC_CODE, getEventString(EVENT_EXEC_CALC_CODE));
 
-	hr = SimConnect_SetNotificationGroupPriority(hSimConnect, 1, SIMCONNECT_GROUP_PRIORITY_HIGHEST);
+	hr = SimConnect_SetNotificationGroupPriority(hConnection, 1, SIMCONNECT_GROUP_PRIORITY_HIGHEST);
 
 	// Now register Client Data Area
-	if (!SUCCEEDED(SimConnect_MapClientDataNameToID(hSimConnect, CONFIG_CDA_NAME, CDAId++)))
+	if (!SUCCEEDED(SimConnect_MapClientDataNameToID(hConnection, CONFIG_CDA_NAME, CDAId++)))
 	{
 		LOG_ERROR("SimConnect_MapClientDataNameToID failed!!!!");
 	}
-	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hSimConnect, nextDefinitionID++, SIMCONNECT_CLIENTDATAOFFSET_AUTO, sizeof(CONFIG_CDA), 0, 0)))
+	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hConnection, definitionId++, SIMCONNECT_CLIENTDATAOFFSET_AUTO, sizeof(CONFIG_CDA), 0, 0)))
 	{
 		LOG_ERROR("SimConnect_AddToClientDataDefinition failed!!!!");
 	}
 		
 	// Register Lvar Set Values Client Data Area for write
-	if (!SUCCEEDED(SimConnect_MapClientDataNameToID(hSimConnect, LVARVALUE_CDA_NAME, CDAId++)))
+	if (!SUCCEEDED(SimConnect_MapClientDataNameToID(hConnection, LVARVALUE_CDA_NAME, CDAId++)))
 	{
 		LOG_ERROR("SimConnect_MapClientDataNameToID failed!!!!");
 	}
-	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hSimConnect, nextDefinitionID++, SIMCONNECT_CLIENTDATAOFFSET_AUTO, sizeof(CDASETLVAR), 0, 0)))
+	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hConnection, definitionId++, SIMCONNECT_CLIENTDATAOFFSET_AUTO, sizeof(CDASETLVAR), 0, 0)))
 	{
 		LOG_ERROR("SimConnect_AddToClientDataDefinition failed!!!!");
 	}
 
 	// Register Execute Calculator Code Client Data Area for write
-	if (!SUCCEEDED(SimConnect_MapClientDataNameToID(hSimConnect, CCODE_CDA_NAME, CDAId++)))
+	if (!SUCCEEDED(SimConnect_MapClientDataNameToID(hConnection, CCODE_CDA_NAME, CDAId++)))
+	{
+		LOG_ERROR("SimConnect_MapClientDataNameToID failed!!!!");
+	}
+	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hConnection, definitionId++, SIMCONNECT_CLIENTDATAOFFSET_AUTO, sizeof(CDACALCCODE), 0, 0)))
+	{
+		LOG_ERROR("SimConnect_AddToClientDataDefinition failed!!!!");
+	}
+
+	// Register Set Multiple Lvars Client Data Area for write. This is created by the WASM only if it supports PROTOCOL_SET_LVARS.
+	// A second definition covers just the count, which is used to clear the CDA
+	if (!SUCCEEDED(SimConnect_MapClientDataNameToID(hConnection, LVARVALUES_CDA_NAME, CDAId++)))
+	{
+		LOG_ERROR("SimConnect_MapClientDataNameToID failed!!!!");
+	}
+	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hConnection, definitionId++, 0, sizeof(CDASETLVARS), 0, 0)))
+	{
+		LOG_ERROR("SimConnect_AddToClientDataDefinition failed!!!!");
+	}
+	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hConnection, definitionId++, 0, sizeof(int), 0, 0)))
+	{
+		LOG_ERROR("SimConnect_AddToClientDataDefinition failed!!!!");
+	}
+
+	// Register Set Multiple Hvars Client Data Area for write. This is created by the WASM only if it supports PROTOCOL_SET_HVARS.
+	// As for the set lvars CDA, a second definition covers just the count
+	if (!SUCCEEDED(SimConnect_MapClientDataNameToID(hConnection, HVARS_CDA_NAME, CDAId++)))
+	{
+		LOG_ERROR("SimConnect_MapClientDataNameToID failed!!!!");
+	}
+	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hConnection, definitionId++, 0, sizeof(CDASETHVARS), 0, 0)))
+	{
+		LOG_ERROR("SimConnect_AddToClientDataDefinition failed!!!!");
+	}
+	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hConnection, definitionId++, 0, sizeof(int), 0, 0)))
+	{
+		LOG_ERROR("SimConnect_AddToClientDataDefinition failed!!!!");
+	}
+
+	// Register the Register and Execute Calculator Code Client Data Areas for write. These are created by the WASM only if it supports PROTOCOL_CALC_CODE_HANDLES
+	if (!SUCCEEDED(SimConnect_MapClientDataNameToID(hConnection, CCODEREG_CDA_NAME, CDAId++)))
+	{
+		LOG_ERROR("SimConnect_MapClientDataNameToID failed!!!!");
+	}
+	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hConnection, definitionId++, SIMCONNECT_CLIENTDATAOFFSET_AUTO, sizeof(CDAREGCALCCODE), 0, 0)))
+	{
+		LOG_ERROR("SimConnect_AddToClientDataDefinition failed!!!!");
+	}
+	if (!SUCCEEDED(SimConnect_MapClientDataNameToID(hConnection, CCODEEXEC_CDA_NAME, CDAId++)))
+	{
+		LOG_ERROR("SimConnect_MapClientDataNameToID failed!!!!");
+	}
+	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hConnection, definitionId++, SIMCONNECT_CLIENTDATAOFFSET_AUTO, sizeof(CDAEXECCALCCODE), 0, 0)))
+	{
+		LOG_ERROR("SimConnect_AddToClientDataDefinition failed!!!!");
+	}
+
+	// Register the Calculator Code Batch Client Data Area for write. This is created by the WASM only if it supports PROTOCOL_CALC_CODE_BATCH
+	if (!SUCCEEDED(SimConnect_MapClientDataNameToID(hConnection, CCODEBATCH_CDA_NAME, CDAId++)))
 	{
 		LOG_ERROR("SimConnect_MapClientDataNameToID failed!!!!");
 	}
-	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hSimConnect, nextDefinitionID++, SIMCONNECT_CLIENTDATAOFFSET_AUTO, sizeof(CDACALCCODE), 0, 0)))
+	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hConnection, definitionId++, 0, sizeof(CDACALCCODEBATCH), 0, 0)))
+	{
+		LOG_ERROR("SimConnect_AddToClientDataDefinition failed!!!!");
+	}
+
+	// Sequenced layouts of the Lvar Set Values and Execute Calculator Code Client Data Areas, used only with PROTOCOL_WRITE_SEQUENCE.
+	// These follow the other definitions so that the ids above are unchanged
+	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hConnection, definitionId++, 0, sizeof(CDASETLVARSEQ), 0, 0)))
+	{
+		LOG_ERROR("SimConnect_AddToClientDataDefinition failed!!!!");
+	}
+	if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hConnection, definitionId++, 0, sizeof(CDACALCCODESEQ), 0, 0)))
 	{
 		LOG_ERROR("SimConnect_AddToClientDataDefinition failed!!!!");
 	}
+}
+
+
+DWORD WINAPI WASMIF::SimConnectStart() {
+	int CDAId = 1;
+	nextDefinitionID = 1;
+
+	mapEventsAndCDAs(hSimConnect, CDAId, nextDefinitionID);
 
 	// Initialise are CDA Id bank - this is responsible for:
 	//     - allocating cda ids
 	//     - mapping the id to the name
 	//     - creating the CDA
-	cdaIdBank = new CDAIdBank(CDAId, hSimConnect);
+	cdaIdBank = new CDAIdBank(CDAId, hSimConnect, logger);
 
 	// Set timer to request config data
-	configTimer = SetTimer(hWnd, UINT_PTR(this), 500, &WASMIF::StaticConfigTimer);
+	configTimer = timers.add(500, [this]() { ConfigTimer(); });
 
-	// Start message loop
+	// Start message loop. This blocks until SimConnect has messages, we are woken (on end or queued writes),
+	// or the next timer, write flush or pending set deadline is reached
+	HANDLE waitHandles[2] = { hSimConnectEvent, hWakeEvent };
 	while (0 == quit) {
+		if (WaitForMultipleObjects(2, waitHandles, FALSE, getDispatchTimeout()) == WAIT_FAILED) {
+			LOG_ERROR("WaitForMultipleObjects failed: falling back to polling");
+			Sleep(1);
+		}
+		if (quit) break;
 		SimConnect_CallDispatch(hSimConnect, MyDispatchProc, this);
-		Sleep(1);
+		if (lvarUpdateFrequencyChanged.exchange(false)) applyLvarUpdateFrequency();
+		timers.run();
+		if (writeQueueing && !hWriteThread && GetTickCount64() >= nextWriteFlush) {
+			flushWrites();
+			nextWriteFlush = GetTickCount64() + writeFlushInterval;
+		}
+		if (noPendingSets) expirePendingSets(false);
 	}
+	if (writeQueueing && !hWriteThread) flushWrites();
+	expirePendingSets(true);
 	SimConnectEnd();
 
 	hThread = NULL;
@@ -162,15 +352,31 @@ DWORD WINAPI WASMIF::SimConnectStart() {
 }
 
 
-VOID CALLBACK WASMIF::StaticConfigTimer(HWND hWnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime) {
-	((WASMIF*)idEvent)->ConfigTimer(hWnd, uMsg, dwTime);
-}
+DWORD WASMIF::getDispatchTimeout() {
+	ULONGLONG now = GetTickCount64();
+	ULONGLONG deadline = timers.getNextDeadline();
 
-VOID CALLBACK WASMIF::StaticRequestDataTimer(HWND hWnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime) {
-	((WASMIF*)idEvent)->RequestDataTimer(hWnd, uMsg, dwTime);
+	// Queued writes wake us when there is no flush interval
+	if (writeQueueing && writeFlushInterval && !hWriteThread && nextWriteFlush < deadline) deadline = nextWriteFlush;
+	if (noPendingSets) {
+		EnterCriticalSection(&pendingSetMutex);
+		for (auto& pendingSet : pendingSets) {
+			if (pendingSet.second.deadline < deadline) deadline = pendingSet.second.deadline;
+		}
+		LeaveCriticalSection(&pendingSetMutex);
+	}
+	if (deadline == ULLONG_MAX) return INFINITE;
+	return deadline > now ? (DWORD)(deadline - now) : 0;
 }
 
-VOID CALLBACK WASMIF::ConfigTimer(HWND hWnd, UINT uMsg, DWORD dwTime) {
+
+void WASMIF::ConfigTimer() {
+	// Tell the WASM which protocol options we support before asking for the config, which holds those in use
+	if (!SUCCEEDED(SimConnect_TransmitClientEvent(hSimConnect, SIMCONNECT_SIMOBJECT_TYPE_USER, EVENT_SET_PROTOCOL, WAPI_PROTOCOL_FLAGS, SIMCONNECT_GROUP_PRIORITY_HIGHEST, SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY)))
+	{
+		LOG_ERROR("SimConnect_TransmitClientEvent for EVENT_SET_PROTOCOL failed!!!!");
+	}
+
 
 	if (!SUCCEEDED(SimConnect_RequestClientData(hSimConnect, 1, EVENT_CONFIG_RECEIVED, 1,
 		SIMCONNECT_CLIENT_DATA_PERIOD_ONCE, SIMCONNECT_CLIENT_DATA_REQUEST_FLAG_DEFAULT, 0, 0, 0)))
@@ -183,7 +389,9 @@ VOID CALLBACK WASMIF::ConfigTimer(HWND hWnd, UINT uMsg, DWORD dwTime) {
 }
 
 
-VOID CALLBACK WASMIF::RequestDataTimer(HWND hWnd, UINT uMsg, DWORD dwTime) {
+void WASMIF::RequestDataTimer() {
+	if (minLvarUpdateFrequency < maxLvarUpdateFrequency) adaptLvarUpdateFrequency();
+
 	// Send event to update lvar list
 	if (!SUCCEEDED(SimConnect_TransmitClientEvent(hSimConnect, SIMCONNECT_SIMOBJECT_TYPE_USER, EVENT_UPDATE_CDAS, 0, SIMCONNECT_GROUP_PRIORITY_HIGHEST, SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY)))
 	{
@@ -192,6 +400,167 @@ VOID CALLBACK WASMIF::RequestDataTimer(HWND hWnd, UINT uMsg, DWORD dwTime) {
 }
 
 
+void WASMIF::adaptLvarUpdateFrequency() {
+	// Double the frequency if enough lvars changed since the last request, halve it after a run of requests with fewer changes.
+	// Some lvars change on almost every request, so any change at all is not enough to raise the frequency
+	char szLogBuffer[128];
+	int freq = lvarUpdateFrequency;
+	int newFreq = freq;
+	int threshold = (int)ceil(lvarChangeThreshold * lvarNames.size());
+	if (threshold < 1) threshold = 1;
+
+	if (lvarChangesSinceRequest >= threshold) {
+		newFreq = min(freq * 2, maxLvarUpdateFrequency.load());
+		staticLvarRequests = 0;
+	}
+	else if (++staticLvarRequests >= ADAPTIVE_BACKOFF_REQUESTS) {
+		newFreq = max(freq / 2, minLvarUpdateFrequency.load());
+		staticLvarRequests = 0;
+	}
+	lvarChangesSinceRequest = 0;
+	if (newFreq != freq && newFreq > 0 && lvarUpdateFrequency.compare_exchange_strong(freq, newFreq)) {
+		timers.setInterval(requestTimer, 1000 / newFreq);
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Lvar update frequency changed from %d to %d", freq, newFreq);
+		LOG_DEBUG(szLogBuffer);
+	}
+}
+
+
+void WASMIF::applyLvarUpdateFrequency() {
+	int freq = lvarUpdateFrequency;
+	staticLvarRequests = 0;
+	if (!freq || !noLvarCDAs) {
+		if (requestTimer) {
+			timers.remove(requestTimer);
+			requestTimer = 0;
+		}
+		return;
+	}
+	if (requestTimer) timers.setInterval(requestTimer, 1000 / freq);
+	else requestTimer = timers.add(1000 / freq, [this]() { RequestDataTimer(); });
+}
+
+
+DWORD WINAPI WASMIF::StaticWriteThreadStart(void* Param) {
+	WASMIF* This = (WASMIF*)Param;
+	return This->WriteThreadStart();
+}
+
+
+DWORD WINAPI WASMIF::WriteThreadStart() {
+	// Dispatches the write connection and, if write queueing is used, flushes the queued writes
+	int CDAId = 1;
+	int definitionId = 1;
+	mapEventsAndCDAs(hSimConnectWrite, CDAId, definitionId);
+
+	HANDLE waitHandles[2] = { hSimConnectWriteEvent, hWriteWakeEvent };
+	while (0 == writeQuit) {
+		DWORD timeout = INFINITE;
+		if (writeQueueing && writeFlushInterval) {
+			ULONGLONG now = GetTickCount64();
+			timeout = nextWriteFlush > now ? (DWORD)(nextWriteFlush - now) : 0;
+		}
+		if (WaitForMultipleObjects(2, waitHandles, FALSE, timeout) == WAIT_FAILED) {
+			LOG_ERROR("WaitForMultipleObjects failed for the write connection: falling back to polling");
+			Sleep(1);
+		}
+		if (writeQuit) break;
+		SimConnect_CallDispatch(hSimConnectWrite, MyWriteDispatchProc, this);
+		if (writeQueueing && GetTickCount64() >= nextWriteFlush) {
+			flushWrites();
+			nextWriteFlush = GetTickCount64() + writeFlushInterval;
+		}
+	}
+	if (writeQueueing) flushWrites();
+
+	return 0;
+}
+
+
+void CALLBACK WASMIF::MyWriteDispatchProc(SIMCONNECT_RECV* pData, DWORD cbData, void* pContext) {
+	WASMIF* procThis = reinterpret_cast<WASMIF*>(pContext);
+	procThis->WriteDispatchProc(pData, cbData);
+}
+
+
+void WASMIF::WriteDispatchProc(SIMCONNECT_RECV* pData, DWORD cbData) {
+	char szLogBuffer[256];
+
+	switch (pData->dwID)
+	{
+	case SIMCONNECT_RECV_ID_EXCEPTION:
+	{
+		SIMCONNECT_RECV_EXCEPTION* except = (SIMCONNECT_RECV_EXCEPTION*)pData;
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Simconnect Exception received on the write connection: %d (dwSendID=%d)", except->dwException, except->dwSendID);
+		LOG_ERROR(szLogBuffer);
+		break;
+	}
+
+	case SIMCONNECT_RECV_ID_QUIT:
+	{
+		quit = 1;
+		SetEvent(hWakeEvent);
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+
+bool WASMIF::startWriteConnection() {
+	char szLogBuffer[256];
+	HRESULT hr;
+
+	hSimConnectWriteEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (!SUCCEEDED(hr = SimConnect_Open(&hSimConnectWrite, "FSUIPC-WASM-IF-Write", NULL, 0, hSimConnectWriteEvent, simConnection))) {
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Failed on SimConnect Open for the write connection: %s", hr == E_INVALIDARG ? "E_INVALIDARG" : "E_FAIL");
+		LOG_ERROR(szLogBuffer);
+		hSimConnectWrite = NULL;
+		stopWriteConnection();
+		return false;
+	}
+	writeQuit = 0;
+	hWriteWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	hWriteThread = CreateThread(NULL, 0, StaticWriteThreadStart, (void*)this, 0, NULL);
+	if (hWriteThread == NULL) {
+		LOG_ERROR("Error creating write thread");
+		stopWriteConnection();
+		return false;
+	}
+	SetThreadPriority(hWriteThread, THREAD_PRIORITY_ABOVE_NORMAL);
+	LOG_INFO("Write connection to MSFS started");
+	return true;
+}
+
+
+void WASMIF::stopWriteConnection() {
+	if (hWriteThread) {
+		writeQuit = 1;
+		SetEvent(hWriteWakeEvent);
+		if (WaitForSingleObject(hWriteThread, 5000) != WAIT_OBJECT_0) {
+			LOG_ERROR("Timed out waiting for the write thread to end");
+		}
+		CloseHandle(hWriteThread);
+		hWriteThread = NULL;
+	}
+	if (hSimConnectWrite && hSimConnectWrite != hSimConnect) {
+		SimConnect_Close(hSimConnectWrite);
+		LOG_INFO("SimConnect_Close done for the write connection");
+	}
+	hSimConnectWrite = NULL;
+	if (hWriteWakeEvent) {
+		CloseHandle(hWriteWakeEvent);
+		hWriteWakeEvent = NULL;
+	}
+	if (hSimConnectWriteEvent) {
+		CloseHandle(hSimConnectWriteEvent);
+		hSimConnectWriteEvent = NULL;
+	}
+}
+
+
 DWORD WINAPI WASMIF::StaticSimConnectThreadStart(void* Param) {
 	WASMIF* This = (WASMIF*)Param;
 	return This->SimConnectStart();
@@ -213,10 +582,28 @@ bool WASMIF::start() {
 	sprintf_s(szLogBuffer, sizeof(szLogBuffer), "**** Starting FSUIPC7 WASM Interface (WAPI) version %s (WASM version %s)", WAPI_VERSION, WASM_VERSION);
 	LOG_INFO(szLogBuffer);
 
-	if (SUCCEEDED(hr = SimConnect_Open(&hSimConnect, "FSUIPC-WASM-IF", NULL, 0, NULL, simConnection)))
+	hSimConnectEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (SUCCEEDED(hr = SimConnect_Open(&hSimConnect, "FSUIPC-WASM-IF", NULL, 0, hSimConnectEvent, simConnection)))
 	{
 		LOG_INFO("Connected to MSFS");
 
+		// Writes use their own connection and thread if requested, otherwise they share this one
+		if (!writeConnection || !startWriteConnection()) hSimConnectWrite = hSimConnect;
+		writeQueue.setWakeEvent(writeFlushInterval ? NULL : (hWriteThread ? hWriteWakeEvent : hWakeEvent));
+
+		if (callbackDelivery == CALLBACK_DELIVERY_ASYNC && hCallbackThread == NULL) {
+			callbackQuit = 0;
+			callbackQueue = new CallbackQueue(callbackQueueSize, callbackOverflow == CALLBACK_OVERFLOW_COALESCE);
+			hCallbackEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+			hCallbackThread = CreateThread(NULL, 0, StaticCallbackThreadStart, (void*)this, 0, NULL);
+			if (hCallbackThread == NULL) {
+				LOG_ERROR("Error creating callback thread");
+				stopCallbackThread();
+				SimConnectEnd();
+				return FALSE;
+			}
+		}
+
 		if (hThread == NULL) {
 			hThread = CreateThread(
 				NULL,							// default security attributes
@@ -241,6 +628,8 @@ bool WASMIF::start() {
 		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Failed on SimConnect Open: cannot connect: %s", hr == E_INVALIDARG ? "E_INVALIDARG":"E_FAIL");
 		LOG_ERROR(szLogBuffer);
 		hSimConnect = NULL;
+		CloseHandle(hSimConnectEvent);
+		hSimConnectEvent = NULL;
 	}
 
 	return FALSE;
@@ -249,61 +638,26 @@ bool WASMIF::start() {
 
 void WASMIF::end() {
 	quit = 1;
+	SetEvent(hWakeEvent);
 }
 
 
 void WASMIF::SimConnectEnd() {
 	char szLogBuffer[256];
-	if (requestTimer) {
-		KillTimer(hWnd, requestTimer);
-		requestTimer = 0;
-	}
-	if (configTimer) {
-		KillTimer(hWnd, configTimer);
-		configTimer = 0;
-	}
+	stopWriteConnection();
+	stopCallbackThread();
+	timers.clear();
+	requestTimer = 0;
+	configTimer = 0;
 
 	// Clear Client Data Definitions
 	// Drop existing CDAs
-	for (int i = 0; i < MAX_NO_VALUE_CDAS; i++) {
-		if (value_cda[i]) {
-			if (!SUCCEEDED(SimConnect_ClearClientDataDefinition(hSimConnect, value_cda[i]->getDefinitionId())))
-			{
-				sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error clearing lvar value data definition with id=%d", value_cda[i]->getId());
-				LOG_ERROR(szLogBuffer);
-			}
-			else {
-				delete value_cda[i];
-				value_cda[i] = 0;
-			}
-		}
-	}
-	for (int i = 0; i < noLvarCDAs; i++)
-	{
-		if (!SUCCEEDED(SimConnect_ClearClientDataDefinition(hSimConnect, lvar_cdas[i]->getDefinitionId())))
-		{
-			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error clearing lvar data definition with id=%d", lvar_cdas[i]->getId());
-			LOG_ERROR(szLogBuffer);
-		}
-		else {
-			delete lvar_cdas[i];
-			lvar_cdas[i] = 0;
-		}
-	}
+	dropCDAs(valueCDAs, "lvar value");
+	dropCDAs(lvarCDAs, "lvar");
 	noLvarCDAs = 0;
-	for (int i = 0; i < noHvarCDAs; i++)
-	{
-		if (!SUCCEEDED(SimConnect_ClearClientDataDefinition(hSimConnect, hvar_cdas[i]->getDefinitionId())))
-		{
-			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error clearing hvar data definition with id=%d", hvar_cdas[i]->getId());
-			LOG_ERROR(szLogBuffer);
-		}
-		else {
-			delete hvar_cdas[i];
-			hvar_cdas[i] = 0;
-		}
-	}
+	dropCDAs(hvarCDAs, "hvar");
 	noHvarCDAs = 0;
+	dropDeltaCDA();
 	delete cdaIdBank;
 	if (!SUCCEEDED(SimConnect_ClearClientDataDefinition(hSimConnect, 1)))
 	{
@@ -316,11 +670,128 @@ void WASMIF::SimConnectEnd() {
 		SimConnect_Close(hSimConnect);
 		LOG_INFO("SimConnect_Close done");
 	}
+	if (hSimConnectEvent) {
+		CloseHandle(hSimConnectEvent);
+		hSimConnectEvent = NULL;
+	}
 
 	hSimConnect = NULL;
 }
 
 
+void WASMIF::dropCDAs(vector<ClientDataArea*>& cdas, const char* cdaType, size_t noKept) {
+	// Drops all but the first noKept CDAs
+	char szLogBuffer[256];
+	for (size_t i = noKept; i < cdas.size(); i++) {
+		ClientDataArea* cda = cdas[i];
+		if (!SUCCEEDED(SimConnect_ClearClientDataDefinition(hSimConnect, cda->getDefinitionId())))
+		{
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error clearing %s data definition with id=%d", cdaType, cda->getId());
+			LOG_ERROR(szLogBuffer);
+		}
+		cdaIdBank->returnId(cda->getName());
+		delete cda;
+	}
+	if (noKept < cdas.size()) cdas.resize(noKept);
+}
+
+
+size_t WASMIF::countUnchangedCDAs(const CONFIG_CDA* configData, int noConfigCDAs, CDAType type, const vector<ClientDataArea*>& cdas) {
+	// Returns the number of CDAs of the type, from the first, whose name and size are unchanged in the new config.
+	// As ids are allocated by position, a change invalidates all the CDAs of the type after it
+	size_t noUnchanged = 0;
+	for (int i = 0; i < noConfigCDAs && noUnchanged < cdas.size(); i++) {
+		if (configData->CDA_Type[i] != type) continue;
+		ClientDataArea* cda = cdas[noUnchanged];
+		if (cda->getName() != configData->CDA_Names[i] || cda->getSize() != configData->CDA_Size[i]) break;
+		noUnchanged++;
+	}
+	return noUnchanged;
+}
+
+
+void WASMIF::publishLvarNames() {
+	// Readers may still hold the previous snapshot, so it is replaced rather than changed
+	atomic_store(&lvarNameSnapshot, shared_ptr<const vector<string>>(make_shared<vector<string>>(lvarNames)));
+}
+
+
+void WASMIF::truncateFlags(vector<unsigned long long>& flags, size_t noLvars) {
+	flags.resize((noLvars + 63) / 64);
+	if (noLvars % 64) flags.back() &= (1ULL << (noLvars % 64)) - 1;
+}
+
+
+void WASMIF::truncateLvars(size_t noLvars) {
+	// Keeps the names, values and flags of the first noLvars lvars - these will be rebuilt for the rest when we receive the data
+	if (noLvars > lvarNames.size()) noLvars = lvarNames.size();
+	bool changed = noLvars < lvarNames.size();
+
+	// Queued updates may refer to the dropped lvar ids, so drop them
+	if (callbackQueue && changed) callbackQueue->clear();
+	// Callback deliveries in progress keep the previous names snapshot
+	lvarNameIndex.resize(noLvars);
+	publishLvarNames();
+	lvarCatalogGeneration++;
+	EnterCriticalSection(&lvarFlagMutex);
+	truncateFlags(lvarCallbackFlags, noLvars);
+	truncateFlags(lvarDeadbandFlags, noLvars);
+	lvarDeadbands.resize(noLvars);
+	LeaveCriticalSection(&lvarFlagMutex);
+	truncateFlags(lvarSubscribedFlags, noLvars);
+	lvarShadowValues.resize(noLvars);
+	if (noLvars) {
+		lvarValues.resize(noLvars);
+		lvarChanges.resize(noLvars);
+		// Pending async sets of the dropped lvar ids cannot be confirmed
+		dropPendingSets((int)noLvars);
+	}
+	else {
+		lvarValues.clear(0);
+		lvarChanges.clear();
+		// Pending async sets refer to the old lvar ids
+		expirePendingSets(true);
+	}
+}
+
+
+void WASMIF::truncateHvars(size_t noHvars) {
+	if (noHvars > hvarNames.size()) noHvars = hvarNames.size();
+	hvarNameIndex.resize(noHvars);
+}
+
+
+void WASMIF::dropDeltaCDA() {
+	char szLogBuffer[256];
+	if (!deltaCDA) return;
+	if (!SUCCEEDED(SimConnect_ClearClientDataDefinition(hSimConnect, deltaCDA->getDefinitionId())))
+	{
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error clearing lvar delta data definition with id=%d", deltaCDA->getId());
+		LOG_ERROR(szLogBuffer);
+	}
+	cdaIdBank->returnId(deltaCDA->getName());
+	delete deltaCDA;
+	deltaCDA = NULL;
+}
+
+
+void WASMIF::receiveNames(const CDAName* names, ClientDataArea* cda, vector<string>& varNames, VarNameIndex& nameIndex, const char* varType) {
+	// Names are placed by the start index of the CDA, so name CDAs may arrive in any order
+	char szLogBuffer[256];
+	size_t startIndex = cda->getStartIndex();
+	size_t endIndex = startIndex + cda->getNoItems();
+	// The names are changed through the index, which removes the entry for any name replaced
+	if (varNames.size() < endIndex) nameIndex.resize(endIndex);
+	for (size_t i = startIndex; i < endIndex; i++)
+	{
+		const char* name = names[i - startIndex].name;
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "%s Data: ID=%03zu, name='%s'", varType, i, name);
+		LOG_TRACE(szLogBuffer);
+		nameIndex.setName((int)i, name, strnlen(name, MAX_VAR_NAME_SIZE));
+	}
+}
+
+
 void CALLBACK WASMIF::MyDispatchProc(SIMCONNECT_RECV* pData, DWORD cbData, void* pContext) {
 	WASMIF* procThis = reinterpret_cast<WASMIF*>(pContext);
 	procThis->DispatchProc(pData, cbData);
@@ -329,7 +800,6 @@ void CALLBACK WASMIF::MyDispatchProc(SIMCONNECT_RECV* pData, DWORD cbData, void*
 
 void WASMIF::DispatchProc(SIMCONNECT_RECV* pData, DWORD cbData) {
 	char szLogBuffer[256];
-	static int noLvarCDAsReceived = 0;
 
 	switch (pData->dwID)
 	{
@@ -343,76 +813,77 @@ void WASMIF::DispatchProc(SIMCONNECT_RECV* pData, DWORD cbData) {
 		{
 			LOG_TRACE("SIMCONNECT_RECV_ID_CLIENT_DATA received: EVENT_CONFIG_RECEIVED");
 			if (configTimer) {
-				KillTimer(hWnd, configTimer);
+				timers.remove(configTimer);
 				configTimer = 0;
 			}
 			if (requestTimer) {
-				KillTimer(hWnd, requestTimer);
+				timers.remove(requestTimer);
 				requestTimer = 0;
 			}
 
-			// Clear current lvar/hvar names and lvar values - these will be rebuilt when we receive the data
-			hvarNames.clear();
-			lvarNames.clear();
-			lvarFlaggedForCallback.clear();
-			EnterCriticalSection(&lvarMutex);
-			lvarValues.clear();
-			LeaveCriticalSection(&lvarMutex);
-
-			// Drop existing CDAs
-			for (int i = 0; i < MAX_NO_VALUE_CDAS; i++) {
-				if (value_cda[i]) {
-					if (!SUCCEEDED(SimConnect_ClearClientDataDefinition(hSimConnect, value_cda[i]->getDefinitionId())))
-					{
-						sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error clearing lvar value data definition with id=%d", value_cda[i]->getId());
-						LOG_ERROR(szLogBuffer);
-					}
-					cdaIdBank->returnId(value_cda[i]->getName());
-					delete value_cda[i];
-					value_cda[i] = 0;
-				}
-			}
-			
-			for (int i = 0; i < noLvarCDAs; i++)
-			{
-				if (!SUCCEEDED(SimConnect_ClearClientDataDefinition(hSimConnect, lvar_cdas[i]->getDefinitionId())))
-				{
-					sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error clearing lvar data definition with id=%d", lvar_cdas[i]->getId());
-					LOG_ERROR(szLogBuffer);
-				}
-				cdaIdBank->returnId(lvar_cdas[i]->getName());
-				delete lvar_cdas[i];
-				lvar_cdas[i] = 0;
-			}
-			noLvarCDAs = 0;
-
-			for (int i = 0; i < noHvarCDAs; i++)
-			{
-				if (!SUCCEEDED(SimConnect_ClearClientDataDefinition(hSimConnect, hvar_cdas[i]->getDefinitionId())))
-				{
-					sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error clearing hvar data definition with id=%d", hvar_cdas[i]->getId());
-					LOG_ERROR(szLogBuffer);
-				}
-				cdaIdBank->returnId(hvar_cdas[i]->getName());
-				delete hvar_cdas[i];
-				hvar_cdas[i] = 0;
-			}
-			noHvarCDAs = 0;
-
 			CONFIG_CDA* configData = (CONFIG_CDA*)&(pObjData->dwData);
+			int newProtocolFlags = configData->protocolFlags & WAPI_PROTOCOL_FLAGS;
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Protocol flags in use: 0x%04x", newProtocolFlags);
+			LOG_DEBUG(szLogBuffer);
 
+			int noConfigCDAs = 0;
+			int noConfigLvarCDAs = 0;
+			int noConfigHvarCDAs = 0;
 			for (int i = 0; i < MAX_NO_LVAR_CDAS + MAX_NO_HVAR_CDAS + MAX_NO_VALUE_CDAS; i++)
 			{
 				if (!configData->CDA_Size[i]) break;
+				noConfigCDAs++;
 				sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Config Data %d: name=%s, size=%d, type=%d", i, configData->CDA_Names[i], configData->CDA_Size[i], configData->CDA_Type[i]);
 				LOG_DEBUG(szLogBuffer);
-				if (configData->CDA_Type[i] == LVARF) noLvarCDAs++;
-				else if (configData->CDA_Type[i] == HVARF) noHvarCDAs++;
+				if (configData->CDA_Type[i] == LVARF) noConfigLvarCDAs++;
+				else if (configData->CDA_Type[i] == HVARF) noConfigHvarCDAs++;
+			}
+
+			// If the WASM keeps unchanged CDAs over a reload, keep those that are unchanged (with their
+			// definitions, requests and data) and only set up the rest. Otherwise, drop them all
+			size_t noKeptLvarCDAs = 0;
+			size_t noKeptHvarCDAs = 0;
+			size_t noKeptValueCDAs = 0;
+			size_t noKeptLvars = 0;
+			size_t noKeptHvars = 0;
+			bool keepDeltaCDA = false;
+			if ((protocolFlags & PROTOCOL_INCREMENTAL_RELOAD) && newProtocolFlags == protocolFlags &&
+					noConfigLvarCDAs + noConfigHvarCDAs && strcmp(configData->version, WASM_VERSION) == 0) {
+				noKeptLvarCDAs = countUnchangedCDAs(configData, noConfigCDAs, LVARF, lvarCDAs);
+				noKeptHvarCDAs = countUnchangedCDAs(configData, noConfigCDAs, HVARF, hvarCDAs);
+				noKeptValueCDAs = countUnchangedCDAs(configData, noConfigCDAs, VALUEF, valueCDAs);
+				if (noKeptLvarCDAs) noKeptLvars = lvarCDAs[noKeptLvarCDAs - 1]->getStartIndex() + lvarCDAs[noKeptLvarCDAs - 1]->getNoItems();
+				if (noKeptHvarCDAs) noKeptHvars = hvarCDAs[noKeptHvarCDAs - 1]->getStartIndex() + hvarCDAs[noKeptHvarCDAs - 1]->getNoItems();
+				// A value CDA is only kept if all the lvars it holds are kept, as unchanged values are not sent again
+				while (noKeptValueCDAs && valueCDAs[noKeptValueCDAs - 1]->getStartIndex() + valueCDAs[noKeptValueCDAs - 1]->getNoItems() > (int)noKeptLvars)
+					noKeptValueCDAs--;
+				if (deltaCDA) {
+					for (int i = 0; i < noConfigCDAs; i++) {
+						if (configData->CDA_Type[i] == DELTAF)
+							keepDeltaCDA = deltaCDA->getName() == configData->CDA_Names[i] && deltaCDA->getSize() == configData->CDA_Size[i];
+					}
+				}
+				sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Incremental reload: keeping %zu of %zu lvar CDAs, %zu of %zu hvar CDAs and %zu of %zu value CDAs",
+					noKeptLvarCDAs, lvarCDAs.size(), noKeptHvarCDAs, hvarCDAs.size(), noKeptValueCDAs, valueCDAs.size());
+				LOG_DEBUG(szLogBuffer);
 			}
+			protocolFlags = newProtocolFlags;
+
+			// Clear the lvar/hvar names and lvar values that are not kept - these will be rebuilt when we receive the data
+			truncateLvars(noKeptLvars);
+			truncateHvars(noKeptHvars);
+
+			// Drop the CDAs that are not kept
+			dropCDAs(valueCDAs, "lvar value", noKeptValueCDAs);
+			dropCDAs(lvarCDAs, "lvar", noKeptLvarCDAs);
+			dropCDAs(hvarCDAs, "hvar", noKeptHvarCDAs);
+			if (!keepDeltaCDA) dropDeltaCDA();
+			noLvarCDAs = noConfigLvarCDAs;
+			noHvarCDAs = noConfigHvarCDAs;
 
 			if (!(noLvarCDAs + noHvarCDAs)) {
 				LOG_TRACE("Empty config data received - requesting again");
-				configTimer = SetTimer(hWnd, UINT_PTR(this), 500, &WASMIF::StaticConfigTimer);
+				configTimer = timers.add(500, [this]() { ConfigTimer(); });
 				break;
 			}
 
@@ -423,67 +894,98 @@ void WASMIF::DispatchProc(SIMCONNECT_RECV* pData, DWORD cbData) {
 				break;
 			}
 
-			// For each config CDA, we need to set a CDA element and request
-			int lvarCount = 0;
-			int hvarCount = 0;
-			int valuesCount = 0;
-			for (int i = 0; i < noLvarCDAs + noHvarCDAs + MAX_NO_VALUE_CDAS; i++)
+			// For each config CDA, we need to set a CDA element and request.
+			// Each CDA type gets its own range of request ids, so that the handler can find the CDA from the request id
+			int lvarStartIndex = 0;
+			int hvarStartIndex = 0;
+			int valueStartIndex = 0;
+			int deltaStartIndex = 0;
+			int lvarIndex = 0;
+			int hvarIndex = 0;
+			int valueIndex = 0;
+			for (int i = 0; i < noConfigCDAs; i++)
 			{
-				// Need to allocate a CDA
-				pair<string, int> cdaDetails = cdaIdBank->getId(configData->CDA_Size[i], configData->CDA_Names[i]);
-				ClientDataArea* cda = new ClientDataArea(cdaDetails.first.c_str(), configData->CDA_Size[i], configData->CDA_Type[i]);
-				cda->setId(cdaDetails.second);
+				vector<ClientDataArea*>* cdas;
+				int* startIndex;
+				int cdaIndex; // Position within the CDAs of the type
+				int requestId;
 				switch (configData->CDA_Type[i]) {
 					case LVARF:
-						lvar_cdas[lvarCount] = cda;
-						break;
+						cdas = &lvarCDAs;
+						startIndex = &lvarStartIndex;
+						cdaIndex = lvarIndex++;
+						requestId = EVENT_LVARS_RECEIVED + cdaIndex;
+						if (cdaIndex < MAX_NO_LVAR_CDAS) break;
+						continue;
 					case HVARF:
-						hvar_cdas[hvarCount] = cda;
-						break;
+						cdas = &hvarCDAs;
+						startIndex = &hvarStartIndex;
+						cdaIndex = hvarIndex++;
+						requestId = EVENT_HVARS_RECEIVED + cdaIndex;
+						if (cdaIndex < MAX_NO_HVAR_CDAS) break;
+						continue;
 					case VALUEF:
-						value_cda[valuesCount] = cda;
-						break;
+						cdas = &valueCDAs;
+						startIndex = &valueStartIndex;
+						cdaIndex = valueIndex++;
+						requestId = EVENT_VALUES_RECEIVED + cdaIndex;
+						if (cdaIndex < MAX_NO_VALUE_CDAS) break;
+						continue;
+					case DELTAF:
+						cdas = NULL;
+						startIndex = &deltaStartIndex;
+						cdaIndex = 0;
+						requestId = EVENT_DELTAS_RECEIVED;
+						if (!deltaCDA && (protocolFlags & PROTOCOL_DELTA_VALUES)) break;
+						continue;
+					default:
+						sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Ignoring config CDA '%s' with unknown type %d", configData->CDA_Names[i], configData->CDA_Type[i]);
+						LOG_ERROR(szLogBuffer);
+						continue;
 				}
-				// Now set-up the definition
-				if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hSimConnect, nextDefinitionID, SIMCONNECT_CLIENTDATAOFFSET_AUTO, configData->CDA_Size[i], 0, 0)))
-				{
-					sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error adding client data definition id %d (%d)", nextDefinitionID, i);
-					LOG_ERROR(szLogBuffer);
+
+				if (cdas && cdaIndex < (int)cdas->size()) {
+					// Kept from the previous config
+					*startIndex += (*cdas)[cdaIndex]->getNoItems();
+					continue;
+				}
+
+				// Need to allocate a CDA
+				pair<string, int> cdaDetails = cdaIdBank->getId(configData->CDA_Size[i], configData->CDA_Names[i]);
+				ClientDataArea* cda = new ClientDataArea(cdaDetails.first.c_str(), configData->CDA_Size[i], configData->CDA_Type[i]);
+				cda->setId(cdaDetails.second);
+				cda->setStartIndex(*startIndex);
+				*startIndex += cda->getNoItems();
+				if (cdas) cdas->push_back(cda);
+				else deltaCDA = cda;
+
+				// Now set-up the definition
+				if (!SUCCEEDED(SimConnect_AddToClientDataDefinition(hSimConnect, nextDefinitionID, SIMCONNECT_CLIENTDATAOFFSET_AUTO, configData->CDA_Size[i], 0, 0)))
+				{
+					sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error adding client data definition id %d (%d)", nextDefinitionID, i);
+					LOG_ERROR(szLogBuffer);
 				}
 				else
 				{
-					switch (configData->CDA_Type[i])
-					{
-					case LVARF:
-						lvar_cdas[lvarCount]->setDefinitionId(nextDefinitionID);
-						break;
-					case HVARF:
-						hvar_cdas[hvarCount]->setDefinitionId(nextDefinitionID);
-						break;
-					case VALUEF:
-						value_cda[valuesCount]->setDefinitionId(nextDefinitionID);
-						break;
-					}
+					cda->setDefinitionId(nextDefinitionID);
 					sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Client data definition added with id=%d (size=%d)", nextDefinitionID, configData->CDA_Size[i]);
 					LOG_DEBUG(szLogBuffer);
 				}
 
 				// Now, add lvars to data area
 				HRESULT hr;
-				switch (configData->CDA_Type[i]) {
-					case LVARF:
-						hr = SimConnect_RequestClientData(hSimConnect, cda->getId(),
-								EVENT_LVARS_RECEIVED + lvarCount++, nextDefinitionID++, SIMCONNECT_CLIENT_DATA_PERIOD_ONCE, SIMCONNECT_CLIENT_DATA_REQUEST_FLAG_DEFAULT);
-						break;
-					case HVARF:
-						hr = SimConnect_RequestClientData(hSimConnect, cda->getId(),
-								EVENT_HVARS_RECEIVED + hvarCount++, nextDefinitionID++, SIMCONNECT_CLIENT_DATA_PERIOD_ONCE, SIMCONNECT_CLIENT_DATA_REQUEST_FLAG_DEFAULT); // SIMCONNECT_CLIENT_DATA_PERIOD_ON_SET?
-						break;
-					case VALUEF:
-						hr = SimConnect_RequestClientData(hSimConnect, cda->getId(),
-								EVENT_VALUES_RECEIVED + valuesCount++, nextDefinitionID++, SIMCONNECT_CLIENT_DATA_PERIOD_ON_SET, SIMCONNECT_CLIENT_DATA_REQUEST_FLAG_CHANGED);
-						break;
-				}
+				if (configData->CDA_Type[i] == VALUEF)
+					hr = SimConnect_RequestClientData(hSimConnect, cda->getId(),
+						requestId, nextDefinitionID++, SIMCONNECT_CLIENT_DATA_PERIOD_ON_SET, SIMCONNECT_CLIENT_DATA_REQUEST_FLAG_CHANGED);
+				else if (configData->CDA_Type[i] == DELTAF) // Every delta written must be received
+					hr = SimConnect_RequestClientData(hSimConnect, cda->getId(),
+						requestId, nextDefinitionID++, SIMCONNECT_CLIENT_DATA_PERIOD_ON_SET, SIMCONNECT_CLIENT_DATA_REQUEST_FLAG_DEFAULT);
+				else if (protocolFlags & PROTOCOL_INCREMENTAL_RELOAD) // Name CDAs are kept over a reload, so receive them again if their contents change
+					hr = SimConnect_RequestClientData(hSimConnect, cda->getId(),
+						requestId, nextDefinitionID++, SIMCONNECT_CLIENT_DATA_PERIOD_ON_SET, SIMCONNECT_CLIENT_DATA_REQUEST_FLAG_CHANGED);
+				else
+					hr = SimConnect_RequestClientData(hSimConnect, cda->getId(),
+						requestId, nextDefinitionID++, SIMCONNECT_CLIENT_DATA_PERIOD_ONCE, SIMCONNECT_CLIENT_DATA_REQUEST_FLAG_DEFAULT);
 				if (hr != S_OK) {
 					sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error requesting CDA '%s' with id=%d and definitionId=%d", configData->CDA_Names[i], cda->getId(), nextDefinitionID-1);
 					LOG_ERROR(szLogBuffer);
@@ -494,11 +996,17 @@ void WASMIF::DispatchProc(SIMCONNECT_RECV* pData, DWORD cbData) {
 					LOG_DEBUG(szLogBuffer);
 				}
 			}
+			noLvarCDAs = (int)lvarCDAs.size();
+			noHvarCDAs = (int)hvarCDAs.size();
+
+			// Pre-size the name indexes and the value store for the number of names the CDAs can hold,
+			// so that the value store is not re-allocated as the name CDAs are received
+			lvarValues.reserve(lvarStartIndex);
+			lvarNameIndex.reserve(lvarStartIndex);
+			hvarNameIndex.reserve(hvarStartIndex);
 
 			// Request data on timer if set
-			if (noLvarCDAs && this->getLvarUpdateFrequency()) {
-				requestTimer = SetTimer(hWnd, UINT_PTR(this), 1000/(this->getLvarUpdateFrequency()), &WASMIF::StaticRequestDataTimer);
-			}
+			applyLvarUpdateFrequency();
 
 
 			// Request config data again when set and changed
@@ -508,192 +1016,94 @@ void WASMIF::DispatchProc(SIMCONNECT_RECV* pData, DWORD cbData) {
 			}
 			else
 				LOG_TRACE("Config data updates requested.");
-			// Reset lvars received counter
-			noLvarCDAsReceived = 0;
-			break;
-		}
-		case EVENT_LVARS_RECEIVED: // Allow for 14 distinct lvar CDAs
-		case EVENT_LVARS_RECEIVED + 1:
-		case EVENT_LVARS_RECEIVED + 2:
-		case EVENT_LVARS_RECEIVED + 3:
-		case EVENT_LVARS_RECEIVED + 4:
-		case EVENT_LVARS_RECEIVED + 5:
-		case EVENT_LVARS_RECEIVED + 6:
-		case EVENT_LVARS_RECEIVED + 7:
-		case EVENT_LVARS_RECEIVED + 8:
-		case EVENT_LVARS_RECEIVED + 9:
-		case EVENT_LVARS_RECEIVED + 10:
-		case EVENT_LVARS_RECEIVED + 11:
-		case EVENT_LVARS_RECEIVED + 12:
-		case EVENT_LVARS_RECEIVED + 13:
-		{
-			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "EVENT_LVARS_RECEIVED: dwObjectID=%d, dwDefineID=%d, dwDefineCount=%d, dwentrynumber=%d, dwoutof=%d",
-					pObjData->dwObjectID, pObjData->dwDefineID, pObjData->dwDefineCount, pObjData->dwentrynumber, pObjData->dwoutof);
-			LOG_DEBUG(szLogBuffer);
-			noLvarCDAsReceived++;
-			CDAName* lvars = (CDAName*)&(pObjData->dwData);
-			// Find id of CDA
-			int cdaId = 0;
-			for (cdaId = 0; cdaId < MAX_NO_LVAR_CDAS; cdaId++)
-			{
-				if (lvar_cdas[cdaId]->getDefinitionId() == pObjData->dwDefineID) break;
-			}
-			if (cdaId < noLvarCDAs)
-			{
-				for (int i = 0; i < lvar_cdas[cdaId]->getNoItems(); i++)
-				{
-					sprintf_s(szLogBuffer, sizeof(szLogBuffer), "LVAR Data: name='%s'", lvars[i].name);
-					LOG_TRACE(szLogBuffer);
-					lvarNames.push_back(string(lvars[i].name));
-					EnterCriticalSection(&lvarMutex);
-					lvarValues.push_back(0.0);
-					LeaveCriticalSection(&lvarMutex);
-					lvarFlaggedForCallback.push_back(FALSE);
-				}
-			}
-			else {
-				sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error: CDA with id=%d not found", pObjData->dwObjectID);
-				LOG_ERROR(szLogBuffer);
-			}
-			if (noLvarCDAsReceived == noLvarCDAs && cdaCbFunction != NULL) {
-				// All lvar names received - call CDA update callback if registered
-				cdaCbFunction();
+
+			// Registered calculator code is dropped by the WASM on reload, so register it again
+			if (protocolFlags & PROTOCOL_CALC_CODE_HANDLES) {
+				EnterCriticalSection(&calcCodeMutex);
+				for (auto& code : registeredCalcCode) queueCalculatorCodeUpload(code.first, code.second.c_str());
+				LeaveCriticalSection(&calcCodeMutex);
 			}
+			// Reset lvars received counter. If all the lvar names were kept, they are available now
+			noLvarCDAsReceived = (int)noKeptLvarCDAs;
+			if (noLvarCDAs && noLvarCDAsReceived >= noLvarCDAs && cdaCbFunction != NULL) deliverCdaUpdate();
 			break;
 		}
-		case EVENT_HVARS_RECEIVED:
-		case EVENT_HVARS_RECEIVED+1:
-		case EVENT_HVARS_RECEIVED+2:
-		case EVENT_HVARS_RECEIVED+3:
-		{
-			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "EVENT_HVARS_RECEIVED: dwObjectID=%d, dwDefineID=%d, dwDefineCount=%d, dwentrynumber=%d, dwoutof=%d",
-				pObjData->dwObjectID, pObjData->dwDefineID, pObjData->dwDefineCount, pObjData->dwentrynumber, pObjData->dwoutof);
-			LOG_DEBUG(szLogBuffer);
-			CDAName* hvars = (CDAName*)&(pObjData->dwData);
-			// Find id of CDA
-			int cdaId = 0;
-			for (cdaId = 0; cdaId < MAX_NO_HVAR_CDAS; cdaId++)
-			{
-				if (hvar_cdas[cdaId]->getDefinitionId() == pObjData->dwDefineID) break;
-			}
-			if (cdaId < noHvarCDAs)
-			{
-				for (int i = 0; i < hvar_cdas[cdaId]->getNoItems(); i++)
-				{
-					sprintf_s(szLogBuffer, sizeof(szLogBuffer), "HVAR Data: ID=%03d, name='%s'", i, hvars[i].name);
-					LOG_TRACE(szLogBuffer);
-					hvarNames.push_back(string(hvars[i].name));
-				}
-			}
-			else {
-				sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error: CDA with id=%d not found", pObjData->dwDefineID);
-				LOG_ERROR(szLogBuffer);
-			}
+		case SIMCONNECT_RECV_ID_EXCEPTION: {
+			SIMCONNECT_RECV_EXCEPTION* except = (SIMCONNECT_RECV_EXCEPTION*)pData;
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Simconnect Exception received: %d (dwSendID=%d)", except->dwException, except->dwSendID);
+			LOG_ERROR(szLogBuffer);
 			break;
 		}
-		case EVENT_VALUES_RECEIVED:
+
+		default:
 		{
-			// Check values match definition
-			if (value_cda[0]->getDefinitionId() != pObjData->dwDefineID) break;
-			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "EVENT_VALUES_RECEIVED: dwObjectID=%d, dwDefineID=%d, dwDefineCount=%d, dwentrynumber=%d, dwoutof=%d",
-				pObjData->dwObjectID, pObjData->dwDefineID, pObjData->dwDefineCount, pObjData->dwentrynumber, pObjData->dwoutof);
-			LOG_TRACE(szLogBuffer);
-			vector<int> flaggedLvarIds;
-			vector<const char*> flaggedLvarNames;
-			vector<double> flaggedLvarValues;
-			CDAValue* values = (CDAValue*)&(pObjData->dwData);
-			EnterCriticalSection(&lvarMutex);
-			for (int i = 0; i < value_cda[0]->getNoItems() && i < lvarNames.size(); i++)
-			{
-				sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Lvar value: ID=%03d, value=%lf", i, values[i].value);
-				LOG_TRACE(szLogBuffer);
-				if (lvarValues.at(i) != values[i].value && lvarFlaggedForCallback.at(i) && (lvarCbFunctionId != NULL || lvarCbFunctionName != NULL)) {
-					sprintf(szLogBuffer, "Flagging lvar for callback: id=%d", i);
-					LOG_DEBUG(szLogBuffer);
-					flaggedLvarIds.push_back(i);
-					flaggedLvarValues.push_back(values[i].value);
-					flaggedLvarNames.push_back(lvarNames.at(i).c_str());
+			// Name and value CDAs: the request id gives the CDA directly
+			DWORD requestId = pObjData->dwRequestID;
+			if (requestId >= EVENT_VALUES_RECEIVED && requestId < EVENT_VALUES_RECEIVED + valueCDAs.size()) {
+				ClientDataArea* cda = valueCDAs[requestId - EVENT_VALUES_RECEIVED];
+				// Check values match definition
+				if (cda->getDefinitionId() != pObjData->dwDefineID) break;
+				if (logger->getLogLevel() >= CPlusPlusLogging::LOG_LEVEL_TRACE) {
+					sprintf_s(szLogBuffer, sizeof(szLogBuffer), "EVENT_VALUES_RECEIVED+%lu: dwObjectID=%d, dwDefineID=%d, dwDefineCount=%d, dwentrynumber=%d, dwoutof=%d",
+						requestId - EVENT_VALUES_RECEIVED, pObjData->dwObjectID, pObjData->dwDefineID, pObjData->dwDefineCount, pObjData->dwentrynumber, pObjData->dwoutof);
+					LOG_TRACE(szLogBuffer);
 				}
-				lvarValues.at(i) = values[i].value;
-			}
- 			LeaveCriticalSection(&lvarMutex);
-			if (lvarCbFunctionId != NULL && flaggedLvarIds.size()) {
-				// Add a terminating element
-				flaggedLvarIds.push_back(-1);
-				flaggedLvarValues.push_back(-1.0);
-				lvarCbFunctionId(flaggedLvarIds.data(), flaggedLvarValues.data());
+				// processValueCDA ignores values past the lvars received
+				processValueCDA(cda->getStartIndex(), (CDAValue*)&(pObjData->dwData), cda->getNoItems());
 			}
-			if (lvarCbFunctionName != NULL && flaggedLvarIds.size()) {
-				// Add a terminating element
-				flaggedLvarNames.push_back(NULL);
-				if (lvarCbFunctionId == NULL) {
-					// Add a terminating value element
-					flaggedLvarValues.push_back(-1.0);
+			else if (requestId == EVENT_DELTAS_RECEIVED && deltaCDA) {
+				if (deltaCDA->getDefinitionId() != pObjData->dwDefineID) break;
+				if (logger->getLogLevel() >= CPlusPlusLogging::LOG_LEVEL_TRACE) {
+					sprintf_s(szLogBuffer, sizeof(szLogBuffer), "EVENT_DELTAS_RECEIVED: dwObjectID=%d, dwDefineID=%d, dwDefineCount=%d, dwentrynumber=%d, dwoutof=%d",
+						pObjData->dwObjectID, pObjData->dwDefineID, pObjData->dwDefineCount, pObjData->dwentrynumber, pObjData->dwoutof);
+					LOG_TRACE(szLogBuffer);
 				}
-				lvarCbFunctionName(flaggedLvarNames.data(), flaggedLvarValues.data());
+				processDeltaCDA((CDADELTA*)&(pObjData->dwData), deltaCDA->getNoItems());
 			}
-			break;
-		}
-		case EVENT_VALUES_RECEIVED + 1:
-		{
-			// Check values match definition
-			if (value_cda[1]->getDefinitionId() != pObjData->dwDefineID) break;
-			if (lvarNames.size() <= 1024) {
-				sprintf_s(szLogBuffer, sizeof(szLogBuffer), "EVENT_VALUES_RECEIVED+1: Ignoring as we only have %llu lvars (dwObjectID=%d, dwDefineID=%d, dwDefineCount=%d, dwentrynumber=%d, dwoutof=%d)",
-					lvarNames.size(), pObjData->dwObjectID, pObjData->dwDefineID, pObjData->dwDefineCount, pObjData->dwentrynumber, pObjData->dwoutof);
+			else if (requestId >= EVENT_LVARS_RECEIVED && requestId < EVENT_LVARS_RECEIVED + lvarCDAs.size()) {
+				ClientDataArea* cda = lvarCDAs[requestId - EVENT_LVARS_RECEIVED];
+				sprintf_s(szLogBuffer, sizeof(szLogBuffer), "EVENT_LVARS_RECEIVED: dwObjectID=%d, dwDefineID=%d, dwDefineCount=%d, dwentrynumber=%d, dwoutof=%d",
+						pObjData->dwObjectID, pObjData->dwDefineID, pObjData->dwDefineCount, pObjData->dwentrynumber, pObjData->dwoutof);
 				LOG_DEBUG(szLogBuffer);
-				break;
-			}
-			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "EVENT_VALUES_RECEIVED+1: dwObjectID=%d, dwDefineID=%d, dwDefineCount=%d, dwentrynumber=%d, dwoutof=%d",
-				pObjData->dwObjectID, pObjData->dwDefineID, pObjData->dwDefineCount, pObjData->dwentrynumber, pObjData->dwoutof);
-			LOG_TRACE(szLogBuffer);
-			vector<int> flaggedLvarIds;
-			vector<const char*> flaggedLvarNames;
-			vector<double> flaggedLvarValues;
-
-			CDAValue* values = (CDAValue*)&(pObjData->dwData);
-			EnterCriticalSection(&lvarMutex);
-			for (int i = 0; i < value_cda[1]->getNoItems() && i+1024 < lvarNames.size(); i++)
-			{
-				sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Lvar value: ID=%03d, value=%lf", i+1024, values[i].value);
-				LOG_TRACE(szLogBuffer);
-				if (lvarValues.at(1024 + i) != values[i].value && lvarFlaggedForCallback.at(1024 + i) && (lvarCbFunctionId != NULL || lvarCbFunctionName != NULL)) {
-					sprintf(szLogBuffer, "Flagging lvar for callback: id=%d", 1024+i);
-					LOG_DEBUG(szLogBuffer);
-					flaggedLvarIds.push_back(1024 + i);
-					flaggedLvarValues.push_back(values[i].value);
-					flaggedLvarNames.push_back(lvarNames.at(1024 + i).c_str());
+				if (cda->getDefinitionId() != pObjData->dwDefineID) {
+					sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error: CDA with id=%d not found", pObjData->dwDefineID);
+					LOG_ERROR(szLogBuffer);
+					break;
+				}
+				noLvarCDAsReceived++;
+				receiveNames((CDAName*)&(pObjData->dwData), cda, lvarNames, lvarNameIndex, "LVAR");
+				lvarValues.resize(lvarNames.size());
+				lvarChanges.resize(lvarNames.size());
+				lvarShadowValues.resize(lvarNames.size(), 0.0);
+				EnterCriticalSection(&lvarFlagMutex);
+				lvarCallbackFlags.resize((lvarNames.size() + 63) / 64, 0);
+				lvarDeadbandFlags.resize((lvarNames.size() + 63) / 64, 0);
+				lvarDeadbands.resize(lvarNames.size(), { 0.0, 0.0, 0.0 });
+				LeaveCriticalSection(&lvarFlagMutex);
+				lvarSubscribedFlags.resize((lvarNames.size() + 63) / 64, 0);
+				resolveLvarSubscriptions();
+				publishLvarNames();
+				lvarCatalogGeneration++;
+				if (noLvarCDAsReceived >= noLvarCDAs && cdaCbFunction != NULL) {
+					// All lvar names received (or changed since) - call CDA update callback if registered
+					deliverCdaUpdate();
 				}
-				lvarValues.at(1024 + i) = values[i].value;
-			}
-			LeaveCriticalSection(&lvarMutex);
-			if (lvarCbFunctionId != NULL && flaggedLvarIds.size()) {
-				// Add a terminating element
-				flaggedLvarIds.push_back(-1);
-				flaggedLvarValues.push_back(-1.0);
-				lvarCbFunctionId(flaggedLvarIds.data(), flaggedLvarValues.data());
 			}
-			else if (lvarCbFunctionName != NULL && flaggedLvarIds.size()) {
-				// Add a terminating element
-				flaggedLvarNames.push_back(NULL);
-				if (lvarCbFunctionId == NULL) {
-					flaggedLvarValues.push_back(-1.0);
+			else if (requestId >= EVENT_HVARS_RECEIVED && requestId < EVENT_HVARS_RECEIVED + hvarCDAs.size()) {
+				ClientDataArea* cda = hvarCDAs[requestId - EVENT_HVARS_RECEIVED];
+				sprintf_s(szLogBuffer, sizeof(szLogBuffer), "EVENT_HVARS_RECEIVED: dwObjectID=%d, dwDefineID=%d, dwDefineCount=%d, dwentrynumber=%d, dwoutof=%d",
+					pObjData->dwObjectID, pObjData->dwDefineID, pObjData->dwDefineCount, pObjData->dwentrynumber, pObjData->dwoutof);
+				LOG_DEBUG(szLogBuffer);
+				if (cda->getDefinitionId() != pObjData->dwDefineID) {
+					sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error: CDA with id=%d not found", pObjData->dwDefineID);
+					LOG_ERROR(szLogBuffer);
+					break;
 				}
-				lvarCbFunctionName(flaggedLvarNames.data(), flaggedLvarValues.data());
-
+				receiveNames((CDAName*)&(pObjData->dwData), cda, hvarNames, hvarNameIndex, "HVAR");
 			}
+			else LOG_TRACE("SIMCONNECT_RECV_ID_CLIENT_DATA received: default");
 			break;
 		}
-		case SIMCONNECT_RECV_ID_EXCEPTION: {
-			SIMCONNECT_RECV_EXCEPTION* except = (SIMCONNECT_RECV_EXCEPTION*)pData;
-			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Simconnect Exception received: %d (dwSendID=%d)", except->dwException, except->dwSendID);
-			LOG_ERROR(szLogBuffer);
-			break;
-		}
-
-		default:
-			LOG_TRACE("SIMCONNECT_RECV_ID_CLIENT_DATA received: default");
-			break;
 		}
 		break;
 	}
@@ -726,6 +1136,382 @@ void WASMIF::DispatchProc(SIMCONNECT_RECV* pData, DWORD cbData) {
 }
 
 
+void WASMIF::processValueCDA(int firstLvarId, const CDAValue* values, int noItems) {
+	char szLogBuffer[256];
+	int noValues = (int)lvarNames.size() - firstLvarId;
+	if (noValues > noItems) noValues = noItems;
+	if (noValues <= 0) return;
+
+	LogLevel logLevel = logger->getLogLevel();
+	if (logLevel >= CPlusPlusLogging::LOG_LEVEL_TRACE) {
+		for (int i = 0; i < noValues; i++) {
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Lvar value: ID=%03d, value=%lf", firstLvarId + i, values[i].value);
+			LOG_TRACE(szLogBuffer);
+		}
+	}
+
+	if (lvarSubscriptionsChanged.exchange(false)) resolveLvarSubscriptions();
+
+	// Find the values that have changed since the last update of this CDA
+	const double* incoming = &values[0].value;
+	changedMask.resize((noValues + 63) / 64);
+	if (!diffValues(&lvarShadowValues[firstLvarId], incoming, noValues, changedMask.data())) return;
+
+	beginLvarUpdates();
+	EnterCriticalSection(&lvarFlagMutex);
+	for (int word = 0; word < changedMask.size(); word++) {
+		unsigned long long changed = changedMask[word];
+		unsigned long long flagged = updateCallbacks ? changed & getFlagBits(lvarCallbackFlags, firstLvarId + word * 64) : 0;
+		unsigned long long subscribed = updateSubscriptions ? changed & getFlagBits(lvarSubscribedFlags, firstLvarId + word * 64) : 0;
+		while (changed) {
+			int bit = lowestSetBit(changed);
+			changed &= changed - 1;
+			int i = word * 64 + bit;
+			updateLvar(firstLvarId + i, incoming[i], (flagged >> bit) & 1, (subscribed >> bit) & 1);
+		}
+	}
+	LeaveCriticalSection(&lvarFlagMutex);
+	endLvarUpdates();
+}
+
+
+void WASMIF::processDeltaCDA(const CDADELTA* delta, int maxItems) {
+	char szLogBuffer[256];
+	int noItems = delta->noItems;
+	if (noItems > maxItems) noItems = maxItems;
+	if (noItems <= 0) return;
+
+	if (logger->getLogLevel() >= CPlusPlusLogging::LOG_LEVEL_TRACE) {
+		for (int i = 0; i < noItems; i++) {
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Lvar delta: ID=%03d, value=%lf", delta->items[i].id, delta->items[i].value);
+			LOG_TRACE(szLogBuffer);
+		}
+	}
+
+	if (lvarSubscriptionsChanged.exchange(false)) resolveLvarSubscriptions();
+
+	beginLvarUpdates();
+	EnterCriticalSection(&lvarFlagMutex);
+	for (int i = 0; i < noItems; i++) {
+		int lvarId = delta->items[i].id;
+		double value = delta->items[i].value;
+		if (lvarId < 0 || lvarId >= (int)lvarNames.size()) continue;
+		// Compare bit for bit, as the full block diff does
+		if (!memcmp(&lvarShadowValues[lvarId], &value, sizeof(double))) continue;
+		bool flagged = updateCallbacks && (lvarCallbackFlags[lvarId >> 6] >> (lvarId & 63)) & 1;
+		bool subscribed = updateSubscriptions && (lvarSubscribedFlags[lvarId >> 6] >> (lvarId & 63)) & 1;
+		updateLvar(lvarId, value, flagged, subscribed);
+	}
+	LeaveCriticalSection(&lvarFlagMutex);
+	endLvarUpdates();
+}
+
+
+void WASMIF::beginLvarUpdates() {
+	updateCallbacks = lvarCbFunctionId != NULL || lvarCbFunctionName != NULL;
+	updateSubscriptions = hasLvarSubscriptions;
+	pendingLvarUpdates.clear();
+	lvarValues.beginUpdate();
+	lvarChanges.beginUpdate();
+}
+
+
+void WASMIF::updateLvar(int lvarId, double value, bool flagged, bool subscribed) {
+	// Records a changed lvar value, and queues it for the callbacks and subscribers as needed
+	char szLogBuffer[256];
+	lvarValues.setValue(lvarId, value);
+	lvarShadowValues[lvarId] = value;
+	lvarChanges.markChanged(lvarId);
+	lvarChangesSinceRequest++;
+
+	int targets = 0;
+	if (flagged && passesDeadband(lvarId, value)) {
+		if (logger->getLogLevel() >= CPlusPlusLogging::LOG_LEVEL_DEBUG) {
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Flagging lvar for callback: id=%d", lvarId);
+			LOG_DEBUG(szLogBuffer);
+		}
+		targets |= TARGET_CALLBACKS;
+	}
+	if (subscribed) targets |= TARGET_SUBSCRIBERS;
+	if (noPendingSets) confirmPendingSets(lvarId, value);
+	if (targets) {
+		if (callbackQueue) callbackQueue->push(lvarId, value, targets);
+		else pendingLvarUpdates.push_back({ lvarId, value, targets });
+	}
+}
+
+
+void WASMIF::endLvarUpdates() {
+	lvarChanges.endUpdate();
+	lvarValues.endUpdate();
+	if (!completedSets.empty()) completePendingSets();
+
+	if (callbackQueue) {
+		if (updateCallbacks || updateSubscriptions) {
+			callbackQueue->endBatch();
+			SetEvent(hCallbackEvent);
+		}
+	}
+	else deliverLvarUpdates(pendingLvarUpdates);
+}
+
+
+void WASMIF::deliverLvarUpdates(vector<CallbackQueue::QueueEntry>& updates) {
+	if (updates.empty()) return;
+
+	// Subscribers first. They are copied under the subscription lock (which the SimConnect thread
+	// takes when resolving subscriptions) and called outside it. The delivery lock held while calling
+	// them lets unsubscribeLvar wait for a call in progress, so a subscriber is never called after
+	// unsubscribeLvar has returned
+	if (hasLvarSubscriptions) {
+		EnterCriticalSection(&subscriptionMutex);
+		for (const CallbackQueue::QueueEntry& update : updates) {
+			if (!(update.targets & TARGET_SUBSCRIBERS)) continue;
+			auto range = lvarSubscribers.equal_range(update.id);
+			for (auto it = range.first; it != range.second; it++) subscribersToCall.push_back({ it->second, update.id, update.value });
+		}
+		LeaveCriticalSection(&subscriptionMutex);
+
+		EnterCriticalSection(&callbackDeliveryMutex);
+		for (SUBSCRIBERCALL& call : subscribersToCall) {
+			if (!call.subscription->active) continue;
+			if (call.subscription->callback) call.subscription->callback(call.id, call.value);
+			else call.subscription->callbackFunction(call.id, call.value, call.subscription->context);
+		}
+		LeaveCriticalSection(&callbackDeliveryMutex);
+		subscribersToCall.clear();
+	}
+
+	if (lvarCbFunctionId == NULL && lvarCbFunctionName == NULL) return;
+	// The names handed to the callback point into this snapshot, so they stay valid if the lvars are reloaded meanwhile
+	shared_ptr<const vector<string>> names = atomic_load(&lvarNameSnapshot);
+	callbackIds.clear();
+	callbackValues.clear();
+	callbackNames.clear();
+	for (const CallbackQueue::QueueEntry& update : updates) {
+		if (!(update.targets & TARGET_CALLBACKS)) continue;
+		callbackIds.push_back(update.id);
+		callbackValues.push_back(update.value);
+		if (lvarCbFunctionName != NULL) callbackNames.push_back(update.id < names->size() ? names->at(update.id).c_str() : "");
+	}
+	if (callbackIds.empty()) return;
+
+	if (lvarCbFunctionId != NULL) {
+		// Add a terminating element
+		callbackIds.push_back(-1);
+		callbackValues.push_back(-1.0);
+		lvarCbFunctionId(callbackIds.data(), callbackValues.data());
+	}
+	if (lvarCbFunctionName != NULL) {
+		// Add a terminating element
+		callbackNames.push_back(NULL);
+		if (lvarCbFunctionId == NULL) {
+			// Add a terminating value element
+			callbackValues.push_back(-1.0);
+		}
+		lvarCbFunctionName(callbackNames.data(), callbackValues.data());
+	}
+}
+
+
+void WASMIF::deliverCdaUpdate() {
+	if (callbackQueue) {
+		cdaCallbackPending = true;
+		SetEvent(hCallbackEvent);
+	}
+	else cdaCbFunction();
+}
+
+
+DWORD WINAPI WASMIF::StaticCallbackThreadStart(void* Param) {
+	WASMIF* This = (WASMIF*)Param;
+	return This->CallbackThreadStart();
+}
+
+
+DWORD WINAPI WASMIF::CallbackThreadStart() {
+	CallbackQueue::QueueEntry entry;
+	map<int, CallbackQueue::QueueEntry> overflowUpdates;
+	vector<CallbackQueue::QueueEntry> updates;
+
+	while (0 == callbackQuit) {
+		WaitForSingleObject(hCallbackEvent, INFINITE);
+		if (callbackQuit) break;
+
+		if (cdaCallbackPending.exchange(false) && cdaCbFunction != NULL) cdaCbFunction();
+		for (;;) {
+			while (callbackQueue->pop(entry)) {
+				if (entry.id == CallbackQueue::END_OF_BATCH) {
+					deliverLvarUpdates(updates);
+					updates.clear();
+				}
+				else updates.push_back(entry);
+			}
+			if (callbackQueue->takeOverflow(overflowUpdates)) {
+				for (auto& update : overflowUpdates) updates.push_back(update.second);
+				overflowUpdates.clear();
+			}
+			else if (!callbackQueue->getDepth()) break;
+		}
+		deliverLvarUpdates(updates);
+		updates.clear();
+	}
+
+	return 0;
+}
+
+
+void WASMIF::stopCallbackThread() {
+	if (hCallbackThread) {
+		callbackQuit = 1;
+		SetEvent(hCallbackEvent);
+		if (WaitForSingleObject(hCallbackThread, 5000) != WAIT_OBJECT_0) {
+			// Leave the queue in place as the worker may still be using it
+			LOG_ERROR("Timed out waiting for the callback thread to end");
+			hCallbackThread = NULL;
+			callbackQueue = NULL;
+			return;
+		}
+		CloseHandle(hCallbackThread);
+		hCallbackThread = NULL;
+	}
+	if (hCallbackEvent) {
+		CloseHandle(hCallbackEvent);
+		hCallbackEvent = NULL;
+	}
+	delete callbackQueue;
+	callbackQueue = NULL;
+}
+
+
+void WASMIF::setCallbackDelivery(CALLBACK_DELIVERY delivery, CALLBACK_OVERFLOW overflow, size_t queueSize) {
+	if (hSimConnect) {
+		LOG_ERROR("setCallbackDelivery must be called before start");
+		return;
+	}
+	callbackDelivery = delivery;
+	callbackOverflow = overflow;
+	callbackQueueSize = queueSize;
+}
+
+
+void WASMIF::setWriteQueueing(bool enabled, int flushInterval) {
+	if (hSimConnect) {
+		LOG_ERROR("setWriteQueueing must be called before start");
+		return;
+	}
+	writeQueueing = enabled;
+	writeFlushInterval = flushInterval > 0 ? flushInterval : 0;
+}
+
+
+void WASMIF::setWriteConnection(bool enabled) {
+	if (hSimConnect) {
+		LOG_ERROR("setWriteConnection must be called before start");
+		return;
+	}
+	writeConnection = enabled;
+}
+
+
+void WASMIF::getWriteQueueStats(unsigned long long& queued, unsigned long long& coalesced, unsigned long long& sent) {
+	queued = writeQueue.getQueued();
+	coalesced = writeQueue.getCoalesced();
+	sent = writesSent.load();
+}
+
+
+void WASMIF::flushWrites() {
+	// Sends the queued writes in order. Consecutive double lvar writes, and consecutive hvar
+	// activations, are sent together so that they go in one CDA write when the WASM supports it.
+	// SimConnect thread only
+	if (!writeQueue.take(writeOps)) return;
+	for (size_t i = 0; i < writeOps.size(); i++) {
+		WriteQueue::WriteOp& op = writeOps[i];
+		switch (op.type) {
+			case WRITE_LVAR:
+				flushIds.push_back(op.id);
+				flushValues.push_back(op.value);
+				if (i + 1 < writeOps.size() && writeOps[i + 1].type == WRITE_LVAR) continue;
+				sendLvars(flushIds.data(), flushValues.data(), flushIds.size());
+				flushIds.clear();
+				flushValues.clear();
+				break;
+			case WRITE_LVAR_SHORT:
+			case WRITE_LVAR_USHORT: {
+				DWORD param;
+				BYTE* p = (BYTE*)&param;
+				unsigned short id = (unsigned short)op.id;
+				memcpy(p, &id, 2);
+				if (op.type == WRITE_LVAR_SHORT) {
+					short value = (short)op.value;
+					memcpy(p + 2, &value, 2);
+					setLvarS(param);
+				}
+				else {
+					unsigned short value = (unsigned short)op.value;
+					memcpy(p + 2, &value, 2);
+					setLvar(param);
+				}
+				break;
+			}
+			case WRITE_HVAR:
+				flushIds.push_back(op.id);
+				if (i + 1 < writeOps.size() && writeOps[i + 1].type == WRITE_HVAR) continue;
+				sendHvars(flushIds.data(), flushIds.size());
+				flushIds.clear();
+				break;
+			case WRITE_CALC_CODE:
+				flushCodes.push_back(op.calcCode.c_str());
+				if (i + 1 < writeOps.size() && writeOps[i + 1].type == WRITE_CALC_CODE) continue;
+				sendCalculatorCodes(flushCodes.data(), flushCodes.size());
+				flushCodes.clear();
+				break;
+			case WRITE_CALC_CODE_HANDLE:
+				sendCalculatorCode(op.id, op.params.data(), (int)op.params.size());
+				break;
+			case WRITE_REG_CALC_CODE:
+				uploadCalculatorCode(op.id, op.calcCode.c_str());
+				break;
+		}
+	}
+	writesSent += writeOps.size();
+	writeOps.clear();
+}
+
+
+void WASMIF::getCallbackQueueStats(size_t& depth, unsigned long long& dropped, unsigned long long& coalesced) {
+	CallbackQueue* queue = callbackQueue;
+	depth = queue ? queue->getDepth() : 0;
+	dropped = queue ? queue->getDropped() : 0;
+	coalesced = queue ? queue->getCoalesced() : 0;
+}
+
+
+unsigned long long WASMIF::getFlagBits(const vector<unsigned long long>& flags, int firstLvarId) {
+	// Returns the 64 flags starting at firstLvarId, which need not be word aligned
+	size_t word = firstLvarId >> 6;
+	int shift = firstLvarId & 63;
+	unsigned long long low = word < flags.size() ? flags[word] : 0;
+	if (!shift) return low;
+	unsigned long long high = word + 1 < flags.size() ? flags[word + 1] : 0;
+	return (low >> shift) | (high << (64 - shift));
+}
+
+
+bool WASMIF::passesDeadband(int lvarId, double newValue) {
+	if (!(lvarDeadbandFlags[lvarId >> 6] & (1ULL << (lvarId & 63)))) return true;
+
+	LVARDEADBAND& deadband = lvarDeadbands[lvarId];
+	double threshold = deadband.relEpsilon * fabs(deadband.lastNotifiedValue);
+	if (threshold < deadband.absEpsilon) threshold = deadband.absEpsilon;
+	// Note that NaN compares false here, so changes to or from NaN always pass
+	if (fabs(newValue - deadband.lastNotifiedValue) <= threshold) return false;
+	deadband.lastNotifiedValue = newValue;
+	return true;
+}
+
+
 void WASMIF::createAircraftLvarFile() {
 	// Send event to create aircraft lvar file
 	if (!SUCCEEDED(SimConnect_TransmitClientEvent(hSimConnect, SIMCONNECT_SIMOBJECT_TYPE_USER, EVENT_LIST_LVARS, 0, SIMCONNECT_GROUP_PRIORITY_HIGHEST, SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY)))
@@ -742,115 +1528,406 @@ void WASMIF::reload() {
 	{
 		LOG_ERROR("SimConnect_TransmitClientEvent for EVENT_RELOAD failed!!!!");
 	}
-
+
+}
+
+
+void WASMIF::setLvarUpdateFrequency(int freq) {
+	if (freq < 0) freq = 0;
+	minLvarUpdateFrequency = freq;
+	maxLvarUpdateFrequency = freq;
+	lvarUpdateFrequency = freq;
+	lvarUpdateFrequencyChanged = true;
+	if (hSimConnect) SetEvent(hWakeEvent);
+}
+
+
+void WASMIF::setLvarUpdateFrequency(int minFreq, int maxFreq, double changeThreshold) {
+	if (minFreq < 1 || maxFreq < minFreq) {
+		LOG_ERROR("setLvarUpdateFrequency: the min frequency must be at least 1 and not greater than the max frequency");
+		return;
+	}
+	if (!(changeThreshold >= 0.0 && changeThreshold <= 1.0)) {
+		LOG_ERROR("setLvarUpdateFrequency: the change threshold must be between 0 and 1");
+		return;
+	}
+	lvarChangeThreshold = changeThreshold;
+	minLvarUpdateFrequency = minFreq;
+	maxLvarUpdateFrequency = maxFreq;
+	lvarUpdateFrequency = maxFreq; // Start high, so that a (re)load is quickly followed by updates
+	lvarUpdateFrequencyChanged = true;
+	if (hSimConnect) SetEvent(hWakeEvent);
+}
+
+
+int WASMIF::getLvarUpdateFrequency() {
+	return lvarUpdateFrequency;
+}
+
+
+void WASMIF::getLvarUpdateJitter(unsigned long long counts[LatencyHistogram::NO_BUCKETS]) {
+	int timer = requestTimer;
+	if (!timer || !timers.getJitter(timer, counts)) {
+		for (int i = 0; i < LatencyHistogram::NO_BUCKETS; i++) counts[i] = 0;
+	}
+}
+
+
+double WASMIF::getLvar(int lvarID) {
+	return lvarValues.getValue(lvarID);
+}
+
+
+double WASMIF::getLvar(const char* lvarName) {
+	int lvarId = getLvarIdFromName(lvarName);
+
+	return lvarValues.getValue(lvarId);
+}
+
+LvarHandle WASMIF::getLvarHandle(const char* lvarName) {
+	LvarHandle handle(lvarName);
+	resolveLvarHandle(handle);
+	return handle;
+}
+
+
+int WASMIF::resolveLvarHandle(LvarHandle& handle) {
+	unsigned int generation = lvarCatalogGeneration;
+	if (handle.generation != generation) {
+		handle.id = lvarNameIndex.find(handle.name);
+		handle.generation = generation;
+	}
+	return handle.id;
+}
+
+
+double WASMIF::getLvar(LvarHandle& handle) {
+	int lvarId = resolveLvarHandle(handle);
+	return lvarId < 0 ? 0.0 : getLvar(lvarId);
+}
+
+void WASMIF::getLvarValues(map<string, double >& returnMap) {
+	vector<double> values(lvarNames.size());
+	size_t noValues = lvarValues.getValues(values.data(), values.size());
+	for (int lvarId = 0; lvarId < noValues; lvarId++) {
+		returnMap.insert(make_pair(lvarNames.at(lvarId), values.at(lvarId)));
+	}
+}
+
+size_t WASMIF::getLvarValues(double* values, size_t maxValues) {
+	return lvarValues.getValues(values, maxValues);
+}
+
+
+void WASMIF::getLvars(const int* ids, double* values, size_t noIds) {
+	lvarValues.getValues(ids, values, noIds);
+}
+
+
+shared_ptr<const vector<string>> WASMIF::getLvarNames() {
+	return atomic_load(&lvarNameSnapshot);
+}
+
+
+unsigned int WASMIF::getLvarCatalogGeneration() {
+	return lvarCatalogGeneration;
+}
+
+
+unsigned long long WASMIF::getLvarValueGeneration() {
+	return lvarChanges.getGeneration();
+}
+
+
+size_t WASMIF::getChangedLvars(const LvarChangeCursor& since, int* ids, double* values, size_t maxLvars, LvarChangeCursor& next) {
+	size_t noLvars = lvarChanges.getChangedSince(since, ids, maxLvars, next);
+	lvarValues.getValues(ids, values, noLvars);
+	return noLvars;
+}
+
+
+void WASMIF::setLvar(unsigned short id, const char* value) {
+	setLvar(id, value, strlen(value));
+}
+
+
+void WASMIF::setLvar(unsigned short id, const char* value, size_t length) {
+	// Integers in range are sent as an (unsigned) short, other numbers as a double,
+	// and anything else as (up to) 8 characters packed into a double
+	char szLogBuffer[512];
+	bool debug = logger->getLogLevel() >= CPlusPlusLogging::LOG_LEVEL_DEBUG;
+	double converted;
+
+	switch (parseLvarValue(value, length, converted)) {
+	case LVAR_VALUE_UNSIGNED_SHORT: {
+		unsigned short value = (unsigned short)converted;
+		setLvar(id, value);
+		if (debug) {
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Setting lvar value as unsigned short: %u", value);
+			LOG_DEBUG(szLogBuffer);
+		}
+		break;
+	}
+	case LVAR_VALUE_SHORT: {
+		short value = (short)converted;
+		setLvar(id, value);
+		if (debug) {
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Setting lvar value as short: %d", value);
+			LOG_DEBUG(szLogBuffer);
+		}
+		break;
+	}
+	case LVAR_VALUE_DOUBLE:
+		setLvar(id, converted);
+		if (debug) {
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Setting lvar value as double: %f", converted);
+			LOG_DEBUG(szLogBuffer);
+		}
+		break;
+	default: {
+		// conversion failed because the input wasn't a number
+		char chars[sizeof(double)] = { 0 };
+		memcpy(chars, value, length < sizeof(chars) ? length : sizeof(chars));
+		memcpy(&converted, chars, sizeof(double));
+		setLvar(id, converted);
+		if (debug) {
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Setting lvar value as string: %.*s", 8, chars);
+			LOG_DEBUG(szLogBuffer);
+		}
+		break;
+	}
+	}
+}
+
+
+void WASMIF::setLvar(unsigned short id, double value) {
+	if (writeQueueing) writeQueue.pushLvar(WRITE_LVAR, id, value);
+	else sendLvar(id, value);
+}
+
+
+void WASMIF::sendLvar(unsigned short id, double value) {
+	char szLogBuffer[256];
+	DWORD dwLastID;
+	HRESULT hr;
+	bool sequenced = protocolFlags & PROTOCOL_WRITE_SEQUENCE;
+	if (sequenced) {
+		CDASETLVARSEQ lvar;
+		lvar.id = id;
+		lvar.lvarValue = value;
+		lvar.sequence = ++writeSequence;
+		hr = SimConnect_SetClientData(hSimConnectWrite, 2, 11, 0, 0, sizeof(CDASETLVARSEQ), &lvar);
+	}
+	else {
+		CDASETLVAR lvar;
+		lvar.id = id;
+		lvar.lvarValue = value;
+		hr = SimConnect_SetClientData(hSimConnectWrite, 2, 2, 0, 0, sizeof(CDASETLVAR), &lvar);
+	}
+	if (!SUCCEEDED(hr)) {
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error setting Client Data lvar value: %d=%f", id, value);
+		LOG_ERROR(szLogBuffer);
+	}
+	else {
+		SimConnect_GetLastSentPacketID(hSimConnectWrite, &dwLastID);
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Lvar set Client Data Area updated [requestID=%d]", dwLastID);
+		LOG_TRACE(szLogBuffer);
+		if (!sequenced) {
+			// Now send an empty request. This is needed to clear the CDA in case the same lvar value is resent
+			CDASETLVAR lvar;
+			lvar.id = -1;
+			lvar.lvarValue = 0;
+			SimConnect_SetClientData(hSimConnectWrite, 2, 2, 0, 0, sizeof(CDASETLVAR), &lvar);
+		}
+	}
 }
 
 
-void WASMIF::setLvarUpdateFrequency(int freq) {
-	lvarUpdateFrequency = freq;
+bool WASMIF::isValidLvarId(int id) {
+	// Ids are sent as unsigned shorts when set individually, so the same limit applies to all paths
+	return id >= 0 && id < 65536 && (size_t)id < lvarValues.size();
 }
 
 
-int WASMIF::getLvarUpdateFrequency() {
-	return lvarUpdateFrequency;
+void WASMIF::setLvars(const int* ids, const double* values, size_t noLvars) {
+	if (writeQueueing) {
+		for (size_t i = 0; i < noLvars; i++) {
+			if (isValidLvarId(ids[i])) writeQueue.pushLvar(WRITE_LVAR, ids[i], values[i]);
+		}
+	}
+	else sendLvars(ids, values, noLvars);
 }
 
 
-double WASMIF::getLvar(int lvarID) {
-	if (lvarID < 0 || lvarID >= lvarValues.size()) return NULL;
-	EnterCriticalSection(&lvarMutex);
-	double result = lvarValues.at(lvarID);
-	LeaveCriticalSection(&lvarMutex);
+void WASMIF::sendLvars(const int* ids, const double* values, size_t noLvars) {
+	char szLogBuffer[256];
+	DWORD dwLastID;
 
-	return result;
+	if (!(protocolFlags & PROTOCOL_SET_LVARS) || noLvars == 1) {
+		// Not supported by the WASM (or not worth it): set each lvar individually
+		for (size_t i = 0; i < noLvars; i++) {
+			if (isValidLvarId(ids[i])) sendLvar((unsigned short)ids[i], values[i]);
+		}
+		return;
+	}
+
+	// Direct sends may come from any thread, so the (preallocated) write buffer is locked while in use
+	EnterCriticalSection(&writeBufferMutex);
+	CDASETLVARS* lvars = &setLvarsBuffer;
+	size_t next = 0;
+	while (next < noLvars) {
+		lvars->noItems = 0;
+		for (; next < noLvars && lvars->noItems < MAX_NO_SET_LVARS; next++) {
+			if (!isValidLvarId(ids[next])) continue;
+			lvars->lvars[lvars->noItems].id = ids[next];
+			lvars->lvars[lvars->noItems].value = values[next];
+			lvars->noItems++;
+		}
+		if (!lvars->noItems) break;
+		lvars->sequence = ++writeSequence;
+		if (!SUCCEEDED(SimConnect_SetClientData(hSimConnectWrite, 4, 4, 0, 0, sizeof(CDASETLVARS), lvars))) {
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error setting Client Data lvar values: %d lvars", lvars->noItems);
+			LOG_ERROR(szLogBuffer);
+		}
+		else {
+			SimConnect_GetLastSentPacketID(hSimConnectWrite, &dwLastID);
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Lvars set Client Data Area updated with %d lvars [requestID=%d]", lvars->noItems, dwLastID);
+			LOG_TRACE(szLogBuffer);
+			if (!(protocolFlags & PROTOCOL_WRITE_SEQUENCE)) {
+				// Now clear the count. This is needed in case the same lvar values are resent
+				int noItems = 0;
+				SimConnect_SetClientData(hSimConnectWrite, 4, 5, 0, 0, sizeof(int), &noItems);
+			}
+		}
+	}
+	LeaveCriticalSection(&writeBufferMutex);
 }
 
 
-double WASMIF::getLvar(const char* lvarName) {
-	int lvarId;
-	for (lvarId = 0; lvarId < lvarNames.size(); lvarId++)
-		if (!strcmp(lvarName, lvarNames.at(lvarId).c_str())) break;
+future<SET_LVAR_RESULT> WASMIF::setLvarAsync(unsigned short id, double value, int timeout) {
+	PENDINGSET pendingSet;
+	pendingSet.result = make_shared<promise<SET_LVAR_RESULT>>();
+	pendingSet.callbackFunction = NULL;
+	pendingSet.context = NULL;
+	future<SET_LVAR_RESULT> result = pendingSet.result->get_future();
+	pendingSet.id = id;
+	pendingSet.target = value;
+	pendingSet.deadline = GetTickCount64() + (timeout > 0 ? timeout : 0);
+	addPendingSet(pendingSet);
+	return result;
+}
 
-	EnterCriticalSection(&lvarMutex);
-	double result = lvarId < lvarValues.size() ? lvarValues.at(lvarId) : 0.0;
-	LeaveCriticalSection(&lvarMutex);
 
-	return result;
+void WASMIF::setLvarAsync(unsigned short id, double value, int timeout, void (*callbackFunction)(int id, SET_LVAR_RESULT result, void* context), void* context) {
+	PENDINGSET pendingSet;
+	pendingSet.callbackFunction = callbackFunction;
+	pendingSet.context = context;
+	pendingSet.id = id;
+	pendingSet.target = value;
+	pendingSet.deadline = GetTickCount64() + (timeout > 0 ? timeout : 0);
+	addPendingSet(pendingSet);
 }
 
-void WASMIF::getLvarValues(map<string, double >& returnMap) {
 
-	EnterCriticalSection(&lvarMutex);
-	for (int lvarId = 0; lvarId < lvarNames.size(); lvarId++) {
-		returnMap.insert(make_pair(lvarNames.at(lvarId), lvarValues.at(lvarId)));
+void WASMIF::addPendingSet(PENDINGSET& pendingSet) {
+	pendingSet.outcome = SET_LVAR_NOT_CONFIRMED;
+	if (pendingSet.id < (int)lvarValues.size() && lvarValues.getValue(pendingSet.id) == pendingSet.target) {
+		// Already has the value, so no change will be received. This is not a confirmation, so no latency is recorded
+		setLvar((unsigned short)pendingSet.id, pendingSet.target);
+		if (pendingSet.result) pendingSet.result->set_value(SET_LVAR_ALREADY_SET);
+		else if (pendingSet.callbackFunction) pendingSet.callbackFunction(pendingSet.id, SET_LVAR_ALREADY_SET, pendingSet.context);
+		return;
 	}
-	LeaveCriticalSection(&lvarMutex);
+	// Register before sending, so that the confirmation cannot be missed
+	QueryPerformanceCounter(&pendingSet.sent);
+	EnterCriticalSection(&pendingSetMutex);
+	pendingSets.insert(make_pair(pendingSet.id, pendingSet));
+	noPendingSets++;
+	LeaveCriticalSection(&pendingSetMutex);
+	// Wake the SimConnect thread so that its wait timeout includes the new deadline
+	SetEvent(hWakeEvent);
+	setLvar((unsigned short)pendingSet.id, pendingSet.target);
 }
 
 
-void WASMIF::setLvar(unsigned short id, const char* value) {
-	char szLogBuffer[512];
-	char* p;
-	double converted = strtod(value, &p);
-	if (*p) {
-		// conversion failed because the input wasn't a number
-		memcpy(&converted, value, sizeof(double));
-		setLvar(id, converted);
-		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Setting lvar value as string: %.*s", 8, (char*)&converted);
-		LOG_DEBUG(szLogBuffer);
-	}
-	else {
-		// use converted
-		// Check if we have an integer
-		int i, r, n;
-		r = sscanf_s(value, "%d%n", &i, &n);
-		if (r == 1 && n == strlen(value)) {
-			// converted is integer
-			if (converted > 0 && converted < 65536) {
-				unsigned short value = (unsigned short)converted;
-				setLvar(id, value);
-				sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Setting lvar value as unsigned short: %u", value);
-				LOG_DEBUG(szLogBuffer);
-			}
-			else if (converted > -32769 && converted < 32768) {
-				short value = (short)converted;
-				setLvar(id, value);
-				sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Setting lvar value as short: %d", value);
-				LOG_DEBUG(szLogBuffer);
-			}
+void WASMIF::confirmPendingSets(int lvarId, double value) {
+	// Called from the value ingest (SimConnect thread) when an lvar changes. Completed sets are
+	// collected and completed after the update, so that no callbacks are made during it
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	EnterCriticalSection(&pendingSetMutex);
+	auto range = pendingSets.equal_range(lvarId);
+	for (auto it = range.first; it != range.second; ) {
+		if (it->second.target == value) {
+			if (performanceFrequency.QuadPart)
+				setLatencies.record((now.QuadPart - it->second.sent.QuadPart) * 1000000 / performanceFrequency.QuadPart);
+			it->second.outcome = SET_LVAR_CONFIRMED;
+			completedSets.push_back(it->second);
+			it = pendingSets.erase(it);
+			noPendingSets--;
 		}
-		else { // floating point number
-			setLvar(id, converted);
-			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Setting lvar value as double: %f", converted);
-			LOG_DEBUG(szLogBuffer);
+		else it++;
+	}
+	LeaveCriticalSection(&pendingSetMutex);
+}
+
+
+void WASMIF::expirePendingSets(bool all) {
+	// Completes the pending sets that have timed out (or all, e.g. when the lvars are reloaded)
+	ULONGLONG now = GetTickCount64();
+	EnterCriticalSection(&pendingSetMutex);
+	for (auto it = pendingSets.begin(); it != pendingSets.end(); ) {
+		if (all || now >= it->second.deadline) {
+			it->second.outcome = SET_LVAR_NOT_CONFIRMED;
+			completedSets.push_back(it->second);
+			it = pendingSets.erase(it);
+			noPendingSets--;
+			if (!all) setTimeouts++;
 		}
+		else it++;
 	}
+	LeaveCriticalSection(&pendingSetMutex);
+	if (!completedSets.empty()) completePendingSets();
 }
 
 
-void WASMIF::setLvar(unsigned short id, double value) {
-	char szLogBuffer[256];
-	DWORD dwLastID;
-	CDASETLVAR lvar;
-	lvar.id = id;
-	lvar.lvarValue = value;
-	if (!SUCCEEDED(SimConnect_SetClientData(hSimConnect, 2, 2, 0, 0, sizeof(CDASETLVAR), &lvar))) {
-		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error setting Client Data lvar value: %d=%f", lvar.id, lvar.lvarValue);
-		LOG_ERROR(szLogBuffer);
+void WASMIF::dropPendingSets(int firstLvarId) {
+	// Completes the pending sets of lvar ids that no longer exist
+	EnterCriticalSection(&pendingSetMutex);
+	for (auto it = pendingSets.begin(); it != pendingSets.end(); ) {
+		if (it->second.id >= firstLvarId) {
+			it->second.outcome = SET_LVAR_NOT_CONFIRMED;
+			completedSets.push_back(it->second);
+			it = pendingSets.erase(it);
+			noPendingSets--;
+		}
+		else it++;
 	}
-	else {
-		SimConnect_GetLastSentPacketID(hSimConnect, &dwLastID);
-		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Lvar set Client Data Area updated [requestID=%d]", dwLastID);
-		LOG_TRACE(szLogBuffer);
-		// Now send an empty request. This is needed to clear the CDA in case the same lvar value is resent
-		lvar.id = -1;
-		lvar.lvarValue = 0;
-		SimConnect_SetClientData(hSimConnect, 2, 2, 0, 0, sizeof(CDASETLVAR), &lvar);
+	LeaveCriticalSection(&pendingSetMutex);
+	if (!completedSets.empty()) completePendingSets();
+}
+
+
+void WASMIF::completePendingSets() {
+	for (PENDINGSET& pendingSet : completedSets) {
+		if (pendingSet.result) pendingSet.result->set_value(pendingSet.outcome);
+		else if (pendingSet.callbackFunction) pendingSet.callbackFunction(pendingSet.id, pendingSet.outcome, pendingSet.context);
 	}
+	completedSets.clear();
+}
+
+
+void WASMIF::getSetLatencyHistogram(unsigned long long counts[LatencyHistogram::NO_BUCKETS], unsigned long long& timeouts) {
+	setLatencies.getCounts(counts);
+	timeouts = setTimeouts.load();
 }
 
 
 void WASMIF::setLvar(unsigned short id, short value) {
+	if (writeQueueing) {
+		writeQueue.pushLvar(WRITE_LVAR_SHORT, id, value);
+		return;
+	}
 	DWORD param;
 	BYTE* p = (BYTE*)&param;
 
@@ -860,7 +1937,10 @@ void WASMIF::setLvar(unsigned short id, short value) {
 }
 
 void WASMIF::setLvar(unsigned short id, unsigned short value) {
-
+	if (writeQueueing) {
+		writeQueue.pushLvar(WRITE_LVAR_USHORT, id, value);
+		return;
+	}
 	DWORD param;
 	BYTE* p = (BYTE*)&param;
 
@@ -920,13 +2000,64 @@ void WASMIF::setLvar(const char* lvarName, unsigned short value) {
 	setLvar(id, value);
 }
 
+void WASMIF::setLvar(LvarHandle& handle, const char* value) {
+	int id = resolveLvarHandle(handle);
+
+	if (id < 0) {
+		char szLogBuffer[512];
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error setting Client Data lvar value: %s=%s (No lvar with that name found)", handle.getName(), value);
+		LOG_ERROR(szLogBuffer);
+		return;
+	}
+	setLvar((unsigned short)id, value);
+}
+
+
+void WASMIF::setLvar(LvarHandle& handle, double value) {
+	int id = resolveLvarHandle(handle);
+
+	if (id < 0) {
+		char szLogBuffer[256];
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error setting Client Data lvar value: %s=%f (No lvar with that name found)", handle.getName(), value);
+		LOG_ERROR(szLogBuffer);
+		return;
+	}
+	setLvar((unsigned short)id, value);
+}
+
+
+void WASMIF::setLvar(LvarHandle& handle, short value) {
+	int id = resolveLvarHandle(handle);
+
+	if (id < 0) {
+		char szLogBuffer[256];
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error setting Client Data lvar value: %s=%d (No lvar with that name found)", handle.getName(), value);
+		LOG_ERROR(szLogBuffer);
+		return;
+	}
+	setLvar((unsigned short)id, value);
+}
+
+
+void WASMIF::setLvar(LvarHandle& handle, unsigned short value) {
+	int id = resolveLvarHandle(handle);
+
+	if (id < 0) {
+		char szLogBuffer[256];
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error setting Client Data lvar value: %s=%hu (No lvar with that name found)", handle.getName(), value);
+		LOG_ERROR(szLogBuffer);
+		return;
+	}
+	setLvar((unsigned short)id, value);
+}
+
 void WASMIF::setLvar(DWORD param) {
 	char szLogBuffer[256];
-	if (!SUCCEEDED(SimConnect_TransmitClientEvent(hSimConnect, SIMCONNECT_SIMOBJECT_TYPE_USER, EVENT_SET_LVAR, param, SIMCONNECT_GROUP_PRIORITY_HIGHEST, SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY)))
+	if (!SUCCEEDED(SimConnect_TransmitClientEvent(hSimConnectWrite, SIMCONNECT_SIMOBJECT_TYPE_USER, EVENT_SET_LVAR, param, SIMCONNECT_GROUP_PRIORITY_HIGHEST, SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY)))
 	{
 		LOG_ERROR("SimConnect_TransmitClientEvent for EVENT_SET_LVAR failed!!!!");
 	}
-	else {
+	else if (logger->getLogLevel() >= CPlusPlusLogging::LOG_LEVEL_DEBUG) {
 		unsigned short value = static_cast<unsigned short>(param >> (2 * 8));
 		unsigned short id = static_cast<unsigned short>(param % (1 << (2 * 8)));
 		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Control sent to set lvars with parameter %d (%X): lvarId=%u (%X), value=%u (%X)", param, param,
@@ -937,11 +2068,11 @@ void WASMIF::setLvar(DWORD param) {
 }
 void WASMIF::setLvarS(DWORD param) {
 	char szLogBuffer[256];
-	if (!SUCCEEDED(SimConnect_TransmitClientEvent(hSimConnect, SIMCONNECT_SIMOBJECT_TYPE_USER, EVENT_SET_LVARS, param, SIMCONNECT_GROUP_PRIORITY_HIGHEST, SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY)))
+	if (!SUCCEEDED(SimConnect_TransmitClientEvent(hSimConnectWrite, SIMCONNECT_SIMOBJECT_TYPE_USER, EVENT_SET_LVARS, param, SIMCONNECT_GROUP_PRIORITY_HIGHEST, SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY)))
 	{
 		LOG_ERROR("SimConnect_TransmitClientEvent for EVENT_SET_LVARS failed!!!!");
 	}
-	else {
+	else if (logger->getLogLevel() >= CPlusPlusLogging::LOG_LEVEL_DEBUG) {
 		unsigned short value = static_cast<short>(param >> (2 * 8));
 		unsigned short id = static_cast<unsigned short>(param % (1 << (2 * 8)));
 		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Control sent to set lvars with parameter %d (%X): lvarId=%u (%X), value=%d (%X)", param, param,
@@ -952,31 +2083,248 @@ void WASMIF::setLvarS(DWORD param) {
 }
 
 
+bool WASMIF::checkCalculatorCodeSize(const char* code) {
+	char szLogBuffer[128];
+	size_t maxSize = (protocolFlags & PROTOCOL_CALC_CODE_BATCH) ? MAX_CALC_CODE_BATCH_SIZE : MAX_CALC_CODE_SIZE;
+
+	if (code == NULL || strlen(code) > maxSize - 1) {
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error setting Client Data Calculator Code: code contains %zd characters, max allowed is %zd",
+			code == NULL ? (size_t)0 : strlen(code), maxSize - 1);
+		LOG_ERROR(szLogBuffer);
+		return false;
+	}
+	return true;
+}
+
+
 void WASMIF::executeCalclatorCode(const char* code) {
+	// First, check size of provided code
+	if (!checkCalculatorCodeSize(code)) return;
+	if (writeQueueing) {
+		writeQueue.pushCalcCode(code);
+		return;
+	}
+	sendCalculatorCode(code);
+}
+
+
+void WASMIF::executeCalculatorCode(const char* const codes[], size_t noCodes) {
+	for (size_t i = 0; i < noCodes; i++) {
+		if (!checkCalculatorCodeSize(codes[i])) return;
+	}
+	if (writeQueueing) {
+		for (size_t i = 0; i < noCodes; i++) writeQueue.pushCalcCode(codes[i]);
+		return;
+	}
+	sendCalculatorCodes(codes, noCodes);
+}
+
+
+void WASMIF::sendCalculatorCodes(const char* const codes[], size_t noCodes) {
+	char szLogBuffer[256];
+	DWORD dwLastID;
+
+	if (!(protocolFlags & PROTOCOL_CALC_CODE_BATCH) || (noCodes == 1 && strlen(codes[0]) < MAX_CALC_CODE_SIZE)) {
+		// Not supported by the WASM (or not needed): send each script individually
+		for (size_t i = 0; i < noCodes; i++) sendCalculatorCode(codes[i]);
+		return;
+	}
+
+	EnterCriticalSection(&writeBufferMutex);
+	CDACALCCODEBATCH* batch = &calcCodeBatchBuffer;
+	size_t next = 0;
+	while (next < noCodes) {
+		size_t used = 0;
+		batch->noItems = 0;
+		for (; next < noCodes; next++) {
+			size_t length = strlen(codes[next]) + 1;
+			if (length > MAX_CALC_CODE_BATCH_SIZE) {
+				// Checked when queued, but the protocol may have changed since
+				sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error setting Client Data Calculator Code: code contains %zd characters, max allowed is %d",
+					length - 1, MAX_CALC_CODE_BATCH_SIZE - 1);
+				LOG_ERROR(szLogBuffer);
+				continue;
+			}
+			if (used + length > MAX_CALC_CODE_BATCH_SIZE) break;
+			memcpy(batch->calcCode + used, codes[next], length);
+			used += length;
+			batch->noItems++;
+		}
+		if (!batch->noItems) continue;
+		batch->sequence = ++writeSequence;
+		if (!SUCCEEDED(SimConnect_SetClientData(hSimConnectWrite, 8, 10, 0, 0, sizeof(CDACALCCODEBATCH), batch))) {
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error setting Client Data Calculator Code batch: %d scripts", batch->noItems);
+			LOG_ERROR(szLogBuffer);
+		}
+		else {
+			SimConnect_GetLastSentPacketID(hSimConnectWrite, &dwLastID);
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Calculator Code batch Client Data Area updated with %d scripts (%zd bytes) [requestID=%d]", batch->noItems, used, dwLastID);
+			LOG_TRACE(szLogBuffer);
+		}
+	}
+	LeaveCriticalSection(&writeBufferMutex);
+}
+
+
+void WASMIF::sendCalculatorCode(const char* code) {
 	char szLogBuffer[MAX_CALC_CODE_SIZE + 64];
 	DWORD dwLastID;
-	CDACALCCODE ccode;
+	CDACALCCODESEQ ccode; // The sequence number is only sent with PROTOCOL_WRITE_SEQUENCE
 
-	// First, check size of provided code
-	if (code == NULL || strlen(code) > MAX_CALC_CODE_SIZE - 1) {
-		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error setting Client Data Calculator Code: code contains %zd characters, max allowed is %d",
-			code == NULL ? (size_t)0 : strlen(code), MAX_CALC_CODE_SIZE - 1);
-		LOG_ERROR(szLogBuffer);
+	if (strlen(code) > MAX_CALC_CODE_SIZE - 1) {
+		// Only accepted if the WASM supports batches
+		if (protocolFlags & PROTOCOL_CALC_CODE_BATCH) sendCalculatorCodes(&code, 1);
+		else {
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error setting Client Data Calculator Code: code contains %zd characters, max allowed is %d",
+				strlen(code), MAX_CALC_CODE_SIZE - 1);
+			LOG_ERROR(szLogBuffer);
+		}
 		return;
 	}
+
 	strncpy_s(ccode.calcCode, sizeof(ccode.calcCode), code, MAX_CALC_CODE_SIZE);
 	ccode.calcCode[MAX_CALC_CODE_SIZE - 1] = '\0';
-	if (!SUCCEEDED(SimConnect_SetClientData(hSimConnect, 3, 3, 0, 0, sizeof(CDACALCCODE), &ccode))) {
+	bool sequenced = protocolFlags & PROTOCOL_WRITE_SEQUENCE;
+	HRESULT hr;
+	if (sequenced) {
+		ccode.sequence = ++writeSequence;
+		hr = SimConnect_SetClientData(hSimConnectWrite, 3, 12, 0, 0, sizeof(CDACALCCODESEQ), &ccode);
+	}
+	else hr = SimConnect_SetClientData(hSimConnectWrite, 3, 3, 0, 0, sizeof(CDACALCCODE), ccode.calcCode);
+	if (!SUCCEEDED(hr)) {
 		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error setting Client Data Calculator Code: '%s'", ccode.calcCode);
 		LOG_ERROR(szLogBuffer);
 	}
 	else {
-		SimConnect_GetLastSentPacketID(hSimConnect, &dwLastID);
+		SimConnect_GetLastSentPacketID(hSimConnectWrite, &dwLastID);
 		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Calcultor Code Client Data Area updated [requestID=%d]", dwLastID);
 		LOG_TRACE(szLogBuffer);
-		// Now send an empty request. This is needed to clear the CDA in case the same calc code is resent
-		strcpy(ccode.calcCode, "1");
-		SimConnect_SetClientData(hSimConnect, 3, 3, 0, 0, sizeof(CDACALCCODE), &ccode);
+		if (!sequenced) {
+			// Now send an empty request. This is needed to clear the CDA in case the same calc code is resent
+			strcpy(ccode.calcCode, "1");
+			SimConnect_SetClientData(hSimConnectWrite, 3, 3, 0, 0, sizeof(CDACALCCODE), ccode.calcCode);
+		}
+	}
+}
+
+
+int WASMIF::registerCalculatorCode(const char* code) {
+	char szLogBuffer[128];
+
+	if (code == NULL || !*code || strlen(code) > MAX_REG_CALC_CODE_SIZE - 1) {
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error registering Calculator Code: code contains %zd characters, must be 1 to %d",
+			code == NULL ? (size_t)0 : strlen(code), MAX_REG_CALC_CODE_SIZE - 1);
+		LOG_ERROR(szLogBuffer);
+		return -1;
+	}
+	EnterCriticalSection(&calcCodeMutex);
+	int handle = nextCalcCodeHandle++;
+	registeredCalcCode[handle] = code;
+	if (protocolFlags & PROTOCOL_CALC_CODE_HANDLES) queueCalculatorCodeUpload(handle, code);
+	LeaveCriticalSection(&calcCodeMutex);
+	return handle;
+}
+
+
+void WASMIF::unregisterCalculatorCode(int handle) {
+	EnterCriticalSection(&calcCodeMutex);
+	if (registeredCalcCode.erase(handle) && (protocolFlags & PROTOCOL_CALC_CODE_HANDLES)) queueCalculatorCodeUpload(handle, "");
+	LeaveCriticalSection(&calcCodeMutex);
+}
+
+
+bool WASMIF::getRegisteredCalculatorCode(int handle, string& code) {
+	char szLogBuffer[128];
+	EnterCriticalSection(&calcCodeMutex);
+	auto it = registeredCalcCode.find(handle);
+	if (it != registeredCalcCode.end()) code = it->second;
+	else code.clear();
+	LeaveCriticalSection(&calcCodeMutex);
+	if (code.empty()) {
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error executing Calculator Code: no code registered with handle %d", handle);
+		LOG_ERROR(szLogBuffer);
+		return false;
+	}
+	return true;
+}
+
+
+void WASMIF::queueCalculatorCodeUpload(int handle, const char* code) {
+	// (Un)registrations go through the write queue when it is in use, so that they are kept in order with the executions
+	if (writeQueueing) writeQueue.pushRegCalcCode(handle, code);
+	else uploadCalculatorCode(handle, code);
+}
+
+
+void WASMIF::uploadCalculatorCode(int handle, const char* code) {
+	char szLogBuffer[256];
+	CDAREGCALCCODE regCode;
+
+	regCode.handle = handle;
+	regCode.sequence = ++writeSequence;
+	strncpy_s(regCode.calcCode, sizeof(regCode.calcCode), code, MAX_REG_CALC_CODE_SIZE);
+	regCode.calcCode[MAX_REG_CALC_CODE_SIZE - 1] = '\0';
+	if (!SUCCEEDED(SimConnect_SetClientData(hSimConnectWrite, 6, 8, 0, 0, sizeof(CDAREGCALCCODE), &regCode))) {
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error registering Calculator Code with handle %d: '%.128s'", handle, regCode.calcCode);
+		LOG_ERROR(szLogBuffer);
+	}
+	else {
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Calculator Code registered with handle %d: '%.128s'", handle, regCode.calcCode);
+		LOG_DEBUG(szLogBuffer);
+	}
+}
+
+
+void WASMIF::executeCalculatorCode(int handle, const double* params, int noParams) {
+	if (noParams > MAX_NO_CALC_CODE_PARAMS) {
+		char szLogBuffer[128];
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error executing Calculator Code with handle %d: %d parameters given, max allowed is %d", handle, noParams, MAX_NO_CALC_CODE_PARAMS);
+		LOG_ERROR(szLogBuffer);
+		return;
+	}
+	if (params == NULL) noParams = 0;
+	if (!(protocolFlags & PROTOCOL_CALC_CODE_HANDLES)) {
+		// Not supported by the WASM: execute the text, taken now so that a later unregister cannot overtake a queued execution
+		string code;
+		if (!getRegisteredCalculatorCode(handle, code)) return;
+		if (noParams) LOG_ERROR("Calculator Code parameters are not supported by the WASM: executing without parameters");
+		executeCalclatorCode(code.c_str());
+		return;
+	}
+	if (writeQueueing) writeQueue.pushCalcCode(handle, params, noParams);
+	else sendCalculatorCode(handle, params, noParams);
+}
+
+
+void WASMIF::sendCalculatorCode(int handle, const double* params, int noParams) {
+	char szLogBuffer[128];
+
+	if (!(protocolFlags & PROTOCOL_CALC_CODE_HANDLES)) {
+		// Not supported by the WASM: send the text
+		string code;
+		if (!getRegisteredCalculatorCode(handle, code)) return;
+		if (noParams) LOG_ERROR("Calculator Code parameters are not supported by the WASM: executing without parameters");
+		sendCalculatorCode(code.c_str());
+		return;
+	}
+
+	if (!noParams) {
+		// No parameters: the handle fits in an event parameter
+		if (!SUCCEEDED(SimConnect_TransmitClientEvent(hSimConnectWrite, SIMCONNECT_SIMOBJECT_TYPE_USER, EVENT_EXEC_CALC_CODE, handle, SIMCONNECT_GROUP_PRIORITY_HIGHEST, SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY)))
+		{
+			LOG_ERROR("SimConnect_TransmitClientEvent for EVENT_EXEC_CALC_CODE failed!!!!");
+		}
+		return;
+	}
+
+	CDAEXECCALCCODE execCode;
+	execCode.handle = handle;
+	execCode.sequence = ++writeSequence;
+	execCode.noParams = noParams;
+	memcpy(execCode.params, params, noParams * sizeof(double));
+	if (!SUCCEEDED(SimConnect_SetClientData(hSimConnectWrite, 7, 9, 0, 0, sizeof(CDAEXECCALCCODE), &execCode))) {
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error executing Calculator Code with handle %d", handle);
+		LOG_ERROR(szLogBuffer);
 	}
 }
 
@@ -985,12 +2333,10 @@ void WASMIF::logLvars() {
 	char szLogBuffer[256];
 	sprintf(szLogBuffer, "We have %03llu lvars: ", lvarNames.size());
 	LOG_INFO(szLogBuffer);
-	EnterCriticalSection(&lvarMutex);
 	for (int i = 0; i < lvarNames.size(); i++) {
-		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "    ID=%03d %s = %f", i, lvarNames.at(i).c_str(), lvarValues.at(i));
+		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "    ID=%03d %s = %f", i, lvarNames.at(i).c_str(), lvarValues.getValue(i));
 		LOG_INFO(szLogBuffer);
 	}
-	LeaveCriticalSection(&lvarMutex);
 }
 
 
@@ -1002,8 +2348,13 @@ void WASMIF::getLvarList(unordered_map<int, string >& returnMap) {
 
 
 void WASMIF::setHvar(int id) {
+	if (writeQueueing) writeQueue.pushHvar(id);
+	else sendHvar(id);
+}
+
+void WASMIF::sendHvar(int id) {
 	char szLogBuffer[256];
-	if (!SUCCEEDED(SimConnect_TransmitClientEvent(hSimConnect, SIMCONNECT_SIMOBJECT_TYPE_USER, EVENT_SET_HVAR, id, SIMCONNECT_GROUP_PRIORITY_HIGHEST, SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY)))
+	if (!SUCCEEDED(SimConnect_TransmitClientEvent(hSimConnectWrite, SIMCONNECT_SIMOBJECT_TYPE_USER, EVENT_SET_HVAR, id, SIMCONNECT_GROUP_PRIORITY_HIGHEST, SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY)))
 	{
 		LOG_ERROR("SimConnect_TransmitClientEvent for EVENT_SET_HVAR failed!!!!");
 	}
@@ -1013,6 +2364,54 @@ void WASMIF::setHvar(int id) {
 	}
 }
 
+void WASMIF::setHvars(const int* ids, size_t noHvars) {
+	if (writeQueueing) {
+		for (size_t i = 0; i < noHvars; i++) {
+			if (ids[i] >= 0) writeQueue.pushHvar(ids[i]);
+		}
+	}
+	else sendHvars(ids, noHvars);
+}
+
+void WASMIF::sendHvars(const int* ids, size_t noHvars) {
+	char szLogBuffer[256];
+	DWORD dwLastID;
+
+	if (!(protocolFlags & PROTOCOL_SET_HVARS) || noHvars == 1) {
+		// Not supported by the WASM (or not worth it): activate each hvar individually. Invalid ids are skipped, as in a batch
+		for (size_t i = 0; i < noHvars; i++) {
+			if (ids[i] >= 0) sendHvar(ids[i]);
+		}
+		return;
+	}
+
+	CDASETHVARS hvars;
+	size_t next = 0;
+	while (next < noHvars) {
+		hvars.noItems = 0;
+		for (; next < noHvars && hvars.noItems < MAX_NO_SET_HVARS; next++) {
+			if (ids[next] < 0) continue;
+			hvars.ids[hvars.noItems++] = ids[next];
+		}
+		if (!hvars.noItems) break;
+		hvars.sequence = ++writeSequence;
+		if (!SUCCEEDED(SimConnect_SetClientData(hSimConnectWrite, 5, 6, 0, 0, sizeof(CDASETHVARS), &hvars))) {
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Error setting Client Data hvars: %d hvars", hvars.noItems);
+			LOG_ERROR(szLogBuffer);
+		}
+		else {
+			SimConnect_GetLastSentPacketID(hSimConnectWrite, &dwLastID);
+			sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Hvars set Client Data Area updated with %d hvars [requestID=%d]", hvars.noItems, dwLastID);
+			LOG_TRACE(szLogBuffer);
+			if (!(protocolFlags & PROTOCOL_WRITE_SEQUENCE)) {
+				// Now clear the count. This is needed in case the same hvars are resent
+				int noItems = 0;
+				SimConnect_SetClientData(hSimConnectWrite, 5, 7, 0, 0, sizeof(int), &noItems);
+			}
+		}
+	}
+}
+
 void WASMIF::setHvar(const char* hvarName) {
 	char szLogBuffer[256];
 	int id = getHvarIdFromName(hvarName);
@@ -1022,15 +2421,7 @@ void WASMIF::setHvar(const char* hvarName) {
 		LOG_ERROR(szLogBuffer);
 		return;
 	}
-
-	if (!SUCCEEDED(SimConnect_TransmitClientEvent(hSimConnect, SIMCONNECT_SIMOBJECT_TYPE_USER, EVENT_SET_HVAR, id, SIMCONNECT_GROUP_PRIORITY_HIGHEST, SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY)))
-	{
-		LOG_ERROR("SimConnect_TransmitClientEvent for EVENT_SET_HVAR failed!!!!");
-	}
-	else {
-		sprintf_s(szLogBuffer, sizeof(szLogBuffer), "Control sent to set hvar with id=%d (%X)", id, id);
-		LOG_DEBUG(szLogBuffer);
-	}
+	setHvar(id);
 }
 
 
@@ -1050,10 +2441,8 @@ void WASMIF::getHvarList(unordered_map<int, string >& returnMap) {
 }
 
 int WASMIF::getLvarIdFromName(const char* lvarName) {
-	for (int i = 0; i < lvarNames.size(); i++) {
-		if (lvarNames.at(i) == string(lvarName)) return i;
-	}
-	return -1;
+	if (lvarName == NULL) return -1;
+	return lvarNameIndex.find(lvarName);
 }
 
 void WASMIF::getLvarNameFromId(int id, char* name) {
@@ -1063,10 +2452,8 @@ void WASMIF::getLvarNameFromId(int id, char* name) {
 }
 
 int WASMIF::getHvarIdFromName(const char* hvarName) {
-	for (int i = 0; i < hvarNames.size(); i++) {
-		if (hvarNames.at(i) == string(hvarName)) return i;
-	}
-	return -1;
+	if (hvarName == NULL) return -1;
+	return hvarNameIndex.find(hvarName);
 }
 
 void WASMIF::getHvarNameFromId(int id, char* name) {
@@ -1095,15 +2482,40 @@ void  WASMIF::registerLvarUpdateCallback(void (*callbackFunction)(const char* lv
 	lvarCbFunctionName = callbackFunction;
 }
 void  WASMIF::flagLvarForUpdateCallback(int lvarId) {
+	flagLvarForUpdateCallback(lvarId, 0.0, 0.0);
+}
+
+void  WASMIF::flagLvarForUpdateCallback(int lvarId, double absEpsilon, double relEpsilon) {
+	// Called from user threads while the SimConnect thread reads (and resizes) the flags, so under the flag lock.
+	// The deadbands are sized for the lvars the flags cover
+	EnterCriticalSection(&lvarFlagMutex);
 	if (lvarId < 0) { // Flag all lvars for update
-		for (int i = 0; i < lvarFlaggedForCallback.size(); i++)
-			lvarFlaggedForCallback.at(i) = TRUE;
+		for (int i = 0; i < lvarDeadbands.size(); i++) {
+			lvarCallbackFlags.at(i >> 6) |= 1ULL << (i & 63);
+			setDeadband(i, absEpsilon, relEpsilon);
+		}
 	}
-	else if (lvarId >= 0 && lvarId < lvarFlaggedForCallback.size())
-		lvarFlaggedForCallback.at(lvarId) = TRUE;
+	else if (lvarId < lvarDeadbands.size()) {
+		lvarCallbackFlags.at(lvarId >> 6) |= 1ULL << (lvarId & 63);
+		setDeadband(lvarId, absEpsilon, relEpsilon);
+	}
+	LeaveCriticalSection(&lvarFlagMutex);
+}
+
+void WASMIF::setDeadband(int lvarId, double absEpsilon, double relEpsilon) {
+	// Called with the flag lock held
+	if (absEpsilon > 0.0 || relEpsilon > 0.0) {
+		lvarDeadbands.at(lvarId) = { absEpsilon, relEpsilon, lvarValues.getValue(lvarId) };
+		lvarDeadbandFlags.at(lvarId >> 6) |= 1ULL << (lvarId & 63);
+	}
+	else lvarDeadbandFlags.at(lvarId >> 6) &= ~(1ULL << (lvarId & 63));
 }
 
 void  WASMIF::flagLvarForUpdateCallback(const char* lvarName) {
+	flagLvarForUpdateCallback(lvarName, 0.0, 0.0);
+}
+
+void  WASMIF::flagLvarForUpdateCallback(const char* lvarName, double absEpsilon, double relEpsilon) {
 	int id = getLvarIdFromName(lvarName);
 
 	if (id < 0) {
@@ -1112,7 +2524,86 @@ void  WASMIF::flagLvarForUpdateCallback(const char* lvarName) {
 		LOG_ERROR(szLogBuffer);
 		return;
 	}
-	flagLvarForUpdateCallback(id);
+	flagLvarForUpdateCallback(id, absEpsilon, relEpsilon);
 }
 
 bool  WASMIF::isRunning() { return hSimConnect != NULL; }
+
+
+int WASMIF::subscribeLvar(const char* lvarName, void (*callbackFunction)(int id, double newValue, void* context), void* context) {
+	if (lvarName == NULL || callbackFunction == NULL) return -1;
+	shared_ptr<LVARSUBSCRIPTION> subscription = make_shared<LVARSUBSCRIPTION>();
+	subscription->lvarName = lvarName;
+	subscription->callbackFunction = callbackFunction;
+	subscription->context = context;
+	return addLvarSubscription(subscription);
+}
+
+int WASMIF::subscribeLvar(const char* lvarName, function<void(int id, double newValue)> callbackFunction) {
+	if (lvarName == NULL || !callbackFunction) return -1;
+	shared_ptr<LVARSUBSCRIPTION> subscription = make_shared<LVARSUBSCRIPTION>();
+	subscription->lvarName = lvarName;
+	subscription->callback = callbackFunction;
+	subscription->callbackFunction = NULL;
+	subscription->context = NULL;
+	return addLvarSubscription(subscription);
+}
+
+int WASMIF::subscribeLvar(int lvarId, void (*callbackFunction)(int id, double newValue, void* context), void* context) {
+	// The names may be changing on the SimConnect thread, so take the name from the snapshot
+	shared_ptr<const vector<string>> names = getLvarNames();
+	if (lvarId < 0 || lvarId >= names->size()) return -1;
+	return subscribeLvar(names->at(lvarId).c_str(), callbackFunction, context);
+}
+
+int WASMIF::subscribeLvar(int lvarId, function<void(int id, double newValue)> callbackFunction) {
+	shared_ptr<const vector<string>> names = getLvarNames();
+	if (lvarId < 0 || lvarId >= names->size()) return -1;
+	return subscribeLvar(names->at(lvarId).c_str(), callbackFunction);
+}
+
+int WASMIF::addLvarSubscription(shared_ptr<LVARSUBSCRIPTION> subscription) {
+	subscription->active = true;
+	EnterCriticalSection(&subscriptionMutex);
+	int token = nextSubscriptionToken++;
+	lvarSubscriptions[token] = subscription;
+	hasLvarSubscriptions = true;
+	LeaveCriticalSection(&subscriptionMutex);
+	// The lvar is resolved (and flagged) on the SimConnect thread
+	lvarSubscriptionsChanged = true;
+	return token;
+}
+
+void WASMIF::unsubscribeLvar(int token) {
+	EnterCriticalSection(&subscriptionMutex);
+	auto it = lvarSubscriptions.find(token);
+	if (it != lvarSubscriptions.end()) {
+		for (auto sub = lvarSubscribers.begin(); sub != lvarSubscribers.end(); ) {
+			if (sub->second == it->second) sub = lvarSubscribers.erase(sub);
+			else sub++;
+		}
+		it->second->active = false;
+		lvarSubscriptions.erase(it);
+	}
+	LeaveCriticalSection(&subscriptionMutex);
+	// Subscribers are called outside the subscription lock, so wait for any call in progress
+	EnterCriticalSection(&callbackDeliveryMutex);
+	LeaveCriticalSection(&callbackDeliveryMutex);
+	lvarSubscriptionsChanged = true;
+}
+
+void WASMIF::resolveLvarSubscriptions() {
+	// Re-resolve subscription names to ids. Called on the SimConnect thread when the
+	// subscriptions or the lvar names change
+	EnterCriticalSection(&subscriptionMutex);
+	lvarSubscribers.clear();
+	fill(lvarSubscribedFlags.begin(), lvarSubscribedFlags.end(), 0);
+	for (auto& subscription : lvarSubscriptions) {
+		int id = lvarNameIndex.find(subscription.second->lvarName);
+		if (id < 0 || (size_t)(id >> 6) >= lvarSubscribedFlags.size()) continue;
+		lvarSubscribers.insert(make_pair(id, subscription.second));
+		lvarSubscribedFlags[id >> 6] |= 1ULL << (id & 63);
+	}
+	hasLvarSubscriptions = !lvarSubscriptions.empty();
+	LeaveCriticalSection(&subscriptionMutex);
+}
@@ -2,17 +2,42 @@
 #include <windows.h>
 #include <stdio.h>
 #include <map>
+#include <atomic>
 #include <unordered_map>
 #include <vector>
+#include <memory>
+#include <functional>
+#include <future>
 #include "SimConnect.h"
 #include "WASM.h"
 #include "ClientDataArea.h"
 #include "CDAIdBank.h"
+#include "VarNameIndex.h"
+#include "LvarHandle.h"
+#include "LvarValueStore.h"
+#include "LvarChangeTracker.h"
+#include "CallbackQueue.h"
+#include "WriteQueue.h"
+#include "LatencyHistogram.h"
+#include "TimerScheduler.h"
 
-#define WAPI_VERSION			"0.5.5"
+#define WAPI_VERSION			"0.6.0"
+#define WAPI_PROTOCOL_FLAGS		(PROTOCOL_DELTA_VALUES | PROTOCOL_SET_LVARS | PROTOCOL_WRITE_SEQUENCE | PROTOCOL_SET_HVARS | PROTOCOL_CALC_CODE_HANDLES | PROTOCOL_CALC_CODE_BATCH | PROTOCOL_INCREMENTAL_RELOAD) // Protocol flags supported by this client
+#define LVAR_CHANGE_JOURNAL_SIZE	4096 // Number of lvar changes kept for getChangedLvars before falling back to a scan
+#define CALLBACK_QUEUE_SIZE			4096 // Default number of lvar updates queued for asynchronous callback delivery
+#define ADAPTIVE_CHANGE_THRESHOLD	0.05 // Default fraction of the lvars that must change between lvar update requests for the adaptive frequency to be doubled
+#define ADAPTIVE_BACKOFF_REQUESTS	4 // Number of consecutive lvar update requests below the change threshold before the adaptive frequency is halved
 
 using namespace ClientDataAreaMSFS;
 using namespace CDAIdBankMSFS;
+using namespace VarNameIndexMSFS;
+using namespace LvarHandleMSFS;
+using namespace LvarValueStoreMSFS;
+using namespace LvarChangeTrackerMSFS;
+using namespace CallbackQueueMSFS;
+using namespace WriteQueueMSFS;
+using namespace LatencyHistogramMSFS;
+using namespace TimerSchedulerMSFS;
 
 using namespace std;
 
@@ -26,24 +51,48 @@ enum LOGLEVEL
 	ENABLE_LOG = 6,
 };
 
+enum CALLBACK_DELIVERY
+{
+	CALLBACK_DELIVERY_INLINE = 1, // Callbacks are made on the SimConnect thread (default)
+	CALLBACK_DELIVERY_ASYNC = 2, // Callbacks are queued and made on a separate worker thread
+};
+
+enum CALLBACK_OVERFLOW
+{
+	CALLBACK_OVERFLOW_COALESCE = 1, // When the queue is full, keep only the latest value of each lvar until the worker catches up
+	CALLBACK_OVERFLOW_DROP_OLDEST = 2, // When the queue is full, drop the oldest queued update
+};
+
+enum SET_LVAR_RESULT
+{
+	SET_LVAR_CONFIRMED = 1, // The new value has been received back from the WASM
+	SET_LVAR_ALREADY_SET = 2, // The lvar already had the value, so no change can be received to confirm it. The value is still sent
+	SET_LVAR_NOT_CONFIRMED = 3, // The new value was not received within the timeout, or the lvar was dropped by a reload
+};
+
 class WASMIF
 {
 	public:
 		static class WASMIF* GetInstance(HWND hWnd, int startEventNo = EVENT_START_NO, void (*loggerFunction)(const char* logString) = nullptr);
 		static class WASMIF* GetInstance(HWND hWnd, void (*loggerFunction)(const char* logString));
+		static class WASMIF* CreateInstance(HWND hWnd, int startEventNo = EVENT_START_NO, void (*loggerFunction)(const char* logString) = nullptr); // Creates a further, independent instance, e.g. for another SimConnect connection. Each instance has its own connection, thread and logger (logging to FSUIPC_WASMIF_<n>.log if no logger function is given)
+		static void DestroyInstance(WASMIF* instance); // Ends the instance if it is running and frees it, with its logger if it was created by CreateInstance. The instance must not be used after this
 
 		bool start(); // Startrs the connection to the WASM. 
 		bool isRunning(); // Returns True if cpnnected to the WASM 
 		void end(); // Terminates the connection to the WASM
 		void createAircraftLvarFile(); // Depracated. This re-scans for lvars and puts the output into files (in the WASM work area), with the number of lvars per file being the number that one CDA can hold
 		void reload(); // This sends a request to the WASM ro re-scan for lvars and hvars, and drop/recreate the CDAs
-		void setLvarUpdateFrequency(int freq); // Sets the lvar update frequency in the client. This must be called before start, and only takes affect if lvar update is disabled in the WASM module
+		void setLvarUpdateFrequency(int freq); // Sets the lvar update frequency in the client. This can be changed at any time, and only takes affect if lvar update is disabled in the WASM module
+		void setLvarUpdateFrequency(int minFreq, int maxFreq, double changeThreshold = ADAPTIVE_CHANGE_THRESHOLD); // Sets an adaptive lvar update frequency in the client: the frequency is doubled (up to maxFreq) when at least changeThreshold of the lvars changed since the last request, and halved (down to minFreq) when fewer have
 		void setSimConfigConnection(int connection); // Used to set the SomConnect connection number to be used, from your SimConnect.cfg file.
-		int getLvarUpdateFrequency(); // Returns the lvar update frequency set in the client.
+		int getLvarUpdateFrequency(); // Returns the lvar update frequency set in the client. In adaptive mode, this is the current frequency
+		void getLvarUpdateJitter(unsigned long long counts[LatencyHistogram::NO_BUCKETS]); // Returns the jitter of the client lvar update requests since the lvars were loaded, in microseconds, in power-of-two buckets (see LatencyHistogram.h)
 		void setLogLevel(LOGLEVEL logLevel); // Changs the log level used
 		double getLvar(int lvarID); // Returns an lvar value by lvar ID
 		double getLvar(const char * lvarName); // Returns an lvar value by lvar name. Note that the name should NOT be prefixed by 'L:'
 		void setLvar(unsigned short id, const char* value); // Conveniance function. Sets the lvar value by id. The value is parsed and then either the short, unsigned short or double setLvar function is used 
+		void setLvar(unsigned short id, const char* value, size_t length); // As above, for a value that need not be NUL terminated
 		void setLvar(unsigned short id, double value); // Sets the value of an lvar by id as a double. This request goes via a CDA
 		void setLvar(unsigned short id, short value); // Sets the value of an lvar by id as a (signed) short. This request goes via an event
 		void setLvar(unsigned short id, unsigned short value);// Sets the value of an lvar by id as an unsigned short. This request goes via an event
@@ -51,14 +100,35 @@ class WASMIF
 		void setLvar(const char *lvarName, double value);
 		void setLvar(const char *lvarName, short value);
 		void setLvar(const char *lvarName, unsigned short value);
+		LvarHandle getLvarHandle(const char* lvarName); // Returns a handle for the lvar, resolved against the current lvars. Note that the name should NOT be prefixed by 'L:'
+		double getLvar(LvarHandle& handle); // Returns an lvar value by handle. The handle is re-resolved if the lvars have been reloaded since it was last used
+		void setLvar(LvarHandle& handle, const char* value);
+		void setLvar(LvarHandle& handle, double value);
+		void setLvar(LvarHandle& handle, short value);
+		void setLvar(LvarHandle& handle, unsigned short value);
+		future<SET_LVAR_RESULT> setLvarAsync(unsigned short id, double value, int timeout); // Sets an lvar value by id as a double. The future is set to SET_LVAR_CONFIRMED once the new value has been received back from the WASM, or to SET_LVAR_NOT_CONFIRMED if it has not been received within timeout ms
+		void setLvarAsync(unsigned short id, double value, int timeout, void (*callbackFunction)(int id, SET_LVAR_RESULT result, void* context), void* context); // As above, but calls the callback function (on the SimConnect thread, or on the calling thread for SET_LVAR_ALREADY_SET) instead
+		void getSetLatencyHistogram(unsigned long long counts[LatencyHistogram::NO_BUCKETS], unsigned long long& timeouts); // Returns the round-trip times of confirmed setLvarAsync requests, in microseconds, in power-of-two buckets (see LatencyHistogram.h), and the number that timed out
+		void setLvars(const int* ids, const double* values, size_t noLvars); // Sets the values of multiple lvars by id as doubles. Unknown ids are skipped. Up to MAX_NO_SET_LVARS lvars are sent in each write of a CDA, if supported by the WASM
 		void setHvar(int id); // Activates a HTML variable by ID
 		void setHvar(const char* hvarName); // Activates a HTML variable by name. Note that, unlike lvars, the hvar name must be preceeded by 'H:'
+		void setHvars(const int* ids, size_t noHvars); // Activates multiple HTML variables by ID, in the order given. Negative ids are skipped. Up to MAX_NO_SET_HVARS are sent in each write of a CDA, if supported by the WASM
 		void logLvars(); // Logs all lvars and values (to the defined logger)
 		void getLvarValues(map<string, double >& returnMap); // Returnes a map of all lvar values keyed on the lvar name
+		size_t getLvarValues(double* values, size_t maxValues); // Copies the lvar values, indexed by lvar id, into the provided buffer. Returns the number of values copied
+		void getLvars(const int* ids, double* values, size_t noIds); // Copies the values of the given lvar ids into the provided buffer. Unknown ids return 0.0
+		shared_ptr<const vector<string>> getLvarNames(); // Returns the lvar names, indexed by lvar id. The snapshot is not changed by later reloads - call again when the lvar catalog generation changes
+		unsigned int getLvarCatalogGeneration(); // Returns the lvar catalog generation. This changes whenever the lvar names (and so the lvar ids) change
+		unsigned long long getLvarValueGeneration(); // Returns the current lvar value generation. A cursor of { generation, -1 } returns the changes after this point from getChangedLvars
+		size_t getChangedLvars(const LvarChangeCursor& since, int* ids, double* values, size_t maxLvars, LvarChangeCursor& next); // Returns the ids and current values of the lvars changed since the given cursor, and the cursor to pass on the next call. Pass { 0, -1 } to get all lvars
 		void logHvars(); // Just print to log for now
 		void getLvarList(unordered_map<int, string >& returnMap); // Returns a list of lvar names keyed on the lvar id
 		void getHvarList(unordered_map<int, string >& returnMap); // Returns a list of hvar names keyed on the lvar id
-		void executeCalclatorCode(const char *code); // Executes the argument calculator code. Max allowed length of the code is defined in the WASM.h by MAX_CALC_CODE_SIZE
+		void executeCalclatorCode(const char *code); // Executes the argument calculator code. Max allowed length of the code is defined in the WASM.h by MAX_CALC_CODE_SIZE, or MAX_CALC_CODE_BATCH_SIZE if the WASM supports batches
+		void executeCalculatorCode(const char* const codes[], size_t noCodes); // Executes the scripts in order, packing as many as fit into each write if the WASM supports batches
+		int registerCalculatorCode(const char* code); // Registers calculator code (of up to MAX_REG_CALC_CODE_SIZE - 1 characters) with the WASM so that it is only parsed once. Returns a handle for executeCalculatorCode, or -1 on error
+		void unregisterCalculatorCode(int handle);
+		void executeCalculatorCode(int handle, const double* params = NULL, int noParams = 0); // Executes registered calculator code. Up to MAX_NO_CALC_CODE_PARAMS parameters are available to the code in lvars FSUIPC_CalcParam0 to FSUIPC_CalcParam7. If the WASM does not support registered code, the code is sent as text (without parameters)
 		int getLvarIdFromName(const char* lvarName); // Utility function to get the id of an lvar. Lvar name must not be preceded by 'L:'. -1 retuned if lvar not found
 		void getLvarNameFromId(int id, char* name); // Gets the name of an lvar from an id. The name MUST be allocated to hold a minimum of MAX_VAR_NAME_SIZE (56) bytes
 		int getHvarIdFromName(const char* hvarName); // Utility function to get the id of a hvar. Hvar name must be preceded by 'H:'. -1 retuned if hvar not found
@@ -69,46 +139,216 @@ class WASMIF
 		void registerLvarUpdateCallback(void (*callbackFunction)(const char* lvarName[], double newValue[])); // As above bit returns the lvar the lvar name instead of the id, with the terminating element being NULL. Recommened to be used in your UpdateCallback
 		void flagLvarForUpdateCallback(int lvarId); // Flags an lvar to be included in the lvarUpdateCallback, by ID. Recommened to be used in your UpdateCallback
 		void flagLvarForUpdateCallback(const char* lvarName); // Flags an lvar to be included in the lvarUpdateCallback, by name. Recommened to be used in your UpdateCallback
+		void flagLvarForUpdateCallback(int lvarId, double absEpsilon, double relEpsilon); // As above, but the callback is only made when the value has moved more than absEpsilon, or relEpsilon times its value, from the value last passed to the callback
+		void flagLvarForUpdateCallback(const char* lvarName, double absEpsilon, double relEpsilon);
+		void setCallbackDelivery(CALLBACK_DELIVERY delivery, CALLBACK_OVERFLOW overflow = CALLBACK_OVERFLOW_COALESCE, size_t queueSize = CALLBACK_QUEUE_SIZE); // Sets how the update callbacks are delivered. This must be called before start. With asynchronous delivery, all callbacks are made on the worker thread
+		void getCallbackQueueStats(size_t& depth, unsigned long long& dropped, unsigned long long& coalesced); // Returns the current queue depth and the number of lvar updates dropped or coalesced when using asynchronous callback delivery
+		void setWriteQueueing(bool enabled, int flushInterval = 0); // Queues lvar/hvar/calculator code writes and sends them from the SimConnect thread, every flushInterval ms or (if 0) every dispatch cycle. Repeated writes of an lvar between hvar/calculator code writes are coalesced, keeping the last value. This must be called before start
+		void setWriteConnection(bool enabled); // Uses a second SimConnect connection, with its own (higher priority) thread, for all writes so that they are not delayed by large reads (e.g. on reload). Queued writes are then sent from this thread. This must be called before start
+		void getWriteQueueStats(unsigned long long& queued, unsigned long long& coalesced, unsigned long long& sent); // Returns the number of writes queued, coalesced and sent when write queueing is enabled
+		int subscribeLvar(const char* lvarName, void (*callbackFunction)(int id, double newValue, void* context), void* context); // Subscribes to changes of a single lvar. Returns a subscription token (or -1 on error). Subscriptions are kept by name, so survive a reload
+		int subscribeLvar(const char* lvarName, function<void(int id, double newValue)> callbackFunction);
+		int subscribeLvar(int lvarId, void (*callbackFunction)(int id, double newValue, void* context), void* context); // As above, by lvar ID. The subscription is still kept by the name of the lvar
+		int subscribeLvar(int lvarId, function<void(int id, double newValue)> callbackFunction);
+		void unsubscribeLvar(int token); // Removes a subscription. The callback will not be called once this returns
 
 	public:
 		// Internal functions that need to be public. Do not use.
 		static void CALLBACK MyDispatchProc(SIMCONNECT_RECV* pData, DWORD cbData, void* pContext);
-		static VOID CALLBACK StaticConfigTimer(HWND hWnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime);
-		static VOID CALLBACK StaticRequestDataTimer(HWND hWnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime);
+		static void CALLBACK MyWriteDispatchProc(SIMCONNECT_RECV* pData, DWORD cbData, void* pContext);
 
 	protected:
 		WASMIF();
 		~WASMIF();
 	private:
 		static DWORD WINAPI StaticSimConnectThreadStart(void* Param);
+		static DWORD WINAPI StaticCallbackThreadStart(void* Param);
+		static DWORD WINAPI StaticWriteThreadStart(void* Param);
+		DWORD WINAPI WriteThreadStart();
+		void WriteDispatchProc(SIMCONNECT_RECV* pData, DWORD cbData);
+		bool startWriteConnection();
+		void stopWriteConnection();
+		void mapEventsAndCDAs(HANDLE hConnection, int& CDAId, int& definitionId);
+		DWORD WINAPI CallbackThreadStart();
+		void stopCallbackThread();
+		void deliverLvarUpdates(vector<CallbackQueue::QueueEntry>& updates);
+		void deliverCdaUpdate();
 		void DispatchProc(SIMCONNECT_RECV* pData, DWORD cbData);
-		VOID CALLBACK ConfigTimer(HWND hWnd, UINT uMsg, DWORD dwTime);
-		VOID CALLBACK RequestDataTimer(HWND hWnd, UINT uMsg, DWORD dwTime);
+		void ConfigTimer();
+		void RequestDataTimer();
+		void applyLvarUpdateFrequency();
+		void adaptLvarUpdateFrequency();
 		volatile  HANDLE hThread = NULL;
 		DWORD WINAPI SimConnectStart();
 		void SimConnectEnd();
+		DWORD getDispatchTimeout();
 		const char* getEventString(int eventNo);
 		void setLvar(DWORD param);
 		void setLvarS(DWORD param);
+		int resolveLvarHandle(LvarHandle& handle);
+		void processValueCDA(int firstLvarId, const CDAValue* values, int noItems);
+		void processDeltaCDA(const CDADELTA* delta, int maxItems);
+		void beginLvarUpdates();
+		void updateLvar(int lvarId, double value, bool flagged, bool subscribed);
+		void endLvarUpdates();
+		unsigned long long getFlagBits(const vector<unsigned long long>& flags, int firstLvarId);
+		void sendLvar(unsigned short id, double value);
+		bool isValidLvarId(int id); // In range of the known lvars, and of an unsigned short
+		void sendLvars(const int* ids, const double* values, size_t noLvars);
+		void sendHvar(int id);
+		void sendHvars(const int* ids, size_t noHvars);
+		void sendCalculatorCode(const char* code);
+		void sendCalculatorCodes(const char* const codes[], size_t noCodes);
+		bool checkCalculatorCodeSize(const char* code);
+		void sendCalculatorCode(int handle, const double* params, int noParams);
+		bool getRegisteredCalculatorCode(int handle, string& code);
+		void queueCalculatorCodeUpload(int handle, const char* code);
+		void uploadCalculatorCode(int handle, const char* code);
+		void flushWrites();
+		typedef struct _PENDINGSET
+		{
+			double target;
+			LARGE_INTEGER sent;
+			ULONGLONG deadline;
+			SET_LVAR_RESULT outcome;
+			shared_ptr<promise<SET_LVAR_RESULT>> result;
+			void (*callbackFunction)(int id, SET_LVAR_RESULT result, void* context);
+			void* context;
+			int id;
+		} PENDINGSET;
+		void addPendingSet(PENDINGSET& pendingSet);
+		void confirmPendingSets(int lvarId, double value);
+		void expirePendingSets(bool all);
+		void dropPendingSets(int firstLvarId);
+		void completePendingSets();
+		void dropCDAs(vector<ClientDataArea*>& cdas, const char* cdaType, size_t noKept = 0);
+		void dropDeltaCDA();
+		size_t countUnchangedCDAs(const CONFIG_CDA* configData, int noConfigCDAs, CDAType type, const vector<ClientDataArea*>& cdas);
+		void truncateLvars(size_t noLvars);
+		void publishLvarNames();
+		void truncateHvars(size_t noHvars);
+		static void truncateFlags(vector<unsigned long long>& flags, size_t noLvars);
+		void receiveNames(const CDAName* names, ClientDataArea* cda, vector<string>& varNames, VarNameIndex& nameIndex, const char* varType);
+		bool passesDeadband(int lvarId, double newValue);
+		void setDeadband(int lvarId, double absEpsilon, double relEpsilon);
 
 	private:
 		static WASMIF* m_Instance;
 		HANDLE  hSimConnect;
+		HANDLE hSimConnectEvent = NULL; // Signalled by SimConnect when messages are available
+		HANDLE hWakeEvent = NULL; // Signalled to wake the SimConnect thread, on end or when writes are queued
+		HANDLE hSimConnectWrite = NULL; // Used for all writes. The same as hSimConnect unless a write connection is used
+		HANDLE hSimConnectWriteEvent = NULL;
+		HANDLE hWriteWakeEvent = NULL; // Signalled to wake the write thread, on end or when writes are queued
+		volatile HANDLE hWriteThread = NULL;
+		volatile int writeQuit;
+		bool writeConnection;
 		HWND hWnd;
-		int quit, noLvarCDAs, noHvarCDAs, startEventNo, lvarUpdateFrequency;
-		UINT_PTR configTimer;
-		UINT_PTR requestTimer;
-		ClientDataArea* lvar_cdas[MAX_NO_LVAR_CDAS];
-		ClientDataArea* hvar_cdas[MAX_NO_HVAR_CDAS];
-		ClientDataArea* value_cda[MAX_NO_VALUE_CDAS];
-		static int nextDefinitionID;
+		int quit, noLvarCDAs, noHvarCDAs, startEventNo;
+		atomic<int> lvarUpdateFrequency; // Current frequency, between the min and max in adaptive mode
+		atomic<int> minLvarUpdateFrequency;
+		atomic<int> maxLvarUpdateFrequency;
+		atomic<double> lvarChangeThreshold; // Fraction of the lvars changed between requests that raises the adaptive frequency
+		atomic<bool> lvarUpdateFrequencyChanged; // Applied on the SimConnect thread
+		int lvarChangesSinceRequest; // SimConnect thread only
+		int staticLvarRequests; // No of consecutive requests with lvar changes below the threshold
+		TimerScheduler timers; // Run on the SimConnect thread
+		int configTimer; // Timer ids, 0 if not running
+		int requestTimer;
+		vector<ClientDataArea*> lvarCDAs;
+		vector<ClientDataArea*> hvarCDAs;
+		vector<ClientDataArea*> valueCDAs;
+		ClientDataArea* deltaCDA = NULL;
+		atomic<int> protocolFlags; // Protocol flags in use, from the config CDA
+		atomic<unsigned int> writeSequence; // Sequence number of the last set lvar/calc code CDA write
+		WriteQueue writeQueue;
+		bool writeQueueing;
+		int writeFlushInterval; // ms, 0 for every dispatch cycle
+		ULONGLONG nextWriteFlush;
+		atomic<unsigned long long> writesSent;
+		vector<WriteQueue::WriteOp> writeOps; // SimConnect thread only
+		vector<int> flushIds;
+		vector<double> flushValues;
+		vector<const char*> flushCodes;
+		CDASETLVARS setLvarsBuffer; // Write buffers, reused so that a write does not allocate a whole CDA
+		CDACALCCODEBATCH calcCodeBatchBuffer;
+		CRITICAL_SECTION writeBufferMutex;
+		map<int, string> registeredCalcCode; // Keyed on handle
+		int nextCalcCodeHandle;
+		CRITICAL_SECTION calcCodeMutex;
+		unordered_multimap<int, PENDINGSET> pendingSets; // Keyed on lvar id
+		vector<PENDINGSET> completedSets; // SimConnect thread only
+		atomic<int> noPendingSets;
+		CRITICAL_SECTION pendingSetMutex;
+		LatencyHistogram setLatencies;
+		atomic<unsigned long long> setTimeouts;
+		LARGE_INTEGER performanceFrequency;
+		bool updateCallbacks; // Set for the duration of an lvar update
+		bool updateSubscriptions;
+		int nextDefinitionID;
+		int noLvarCDAsReceived;
+		CPlusPlusLogging::Logger* logger;
+		bool ownsLogger; // Set if the logger was created for this instance, so is destroyed with it
+		static atomic<int> noInstances; // Created with CreateInstance
 		vector<string> lvarNames;
-		vector<double> lvarValues;
-		vector<bool> lvarFlaggedForCallback;
+		LvarValueStore lvarValues;
+		LvarChangeTracker lvarChanges;
+		vector<double> lvarShadowValues; // Last values received, used for change detection. SimConnect thread only
+		vector<unsigned long long> lvarCallbackFlags; // Bitset of lvars flagged for the lvar update callbacks
+		vector<unsigned long long> lvarDeadbandFlags; // Bitset of flagged lvars that have a deadband set
+		typedef struct _LVARDEADBAND
+		{
+			double absEpsilon;
+			double relEpsilon;
+			double lastNotifiedValue;
+		} LVARDEADBAND;
+		vector<LVARDEADBAND> lvarDeadbands;
+		CRITICAL_SECTION lvarFlagMutex; // Guards the callback flags and deadbands, which are set from user threads. Held by the SimConnect thread while it processes a CDA
+		vector<unsigned long long> changedMask;
+		vector<CallbackQueue::QueueEntry> pendingLvarUpdates;
+		vector<int> callbackIds;
+		vector<double> callbackValues;
+		vector<const char*> callbackNames;
 		vector<string> hvarNames;
+		VarNameIndex lvarNameIndex;
+		VarNameIndex hvarNameIndex;
+		shared_ptr<const vector<string>> lvarNameSnapshot; // Replaced (atomically) each time the lvar names change
+		atomic<unsigned int> lvarCatalogGeneration; // Incremented each time the lvar names change
 		CDAIdBank* cdaIdBank;
 		int simConnection;
-		CRITICAL_SECTION        lvarMutex;
+		CALLBACK_DELIVERY callbackDelivery;
+		CALLBACK_OVERFLOW callbackOverflow;
+		size_t callbackQueueSize;
+		CallbackQueue* callbackQueue = NULL;
+		volatile HANDLE hCallbackThread = NULL;
+		HANDLE hCallbackEvent = NULL;
+		volatile int callbackQuit;
+		atomic<bool> cdaCallbackPending;
+		CRITICAL_SECTION callbackDeliveryMutex; // Held while calling subscribers, so that unsubscribeLvar can wait for a call in progress
+		typedef struct _LVARSUBSCRIPTION
+		{
+			string lvarName;
+			void (*callbackFunction)(int id, double newValue, void* context);
+			void* context;
+			function<void(int id, double newValue)> callback;
+			atomic<bool> active; // Cleared by unsubscribeLvar
+		} LVARSUBSCRIPTION;
+		typedef struct _SUBSCRIBERCALL
+		{
+			shared_ptr<LVARSUBSCRIPTION> subscription;
+			int id;
+			double value;
+		} SUBSCRIBERCALL;
+		int addLvarSubscription(shared_ptr<LVARSUBSCRIPTION> subscription);
+		void resolveLvarSubscriptions();
+		map<int, shared_ptr<LVARSUBSCRIPTION>> lvarSubscriptions; // Keyed on token
+		unordered_multimap<int, shared_ptr<LVARSUBSCRIPTION>> lvarSubscribers; // Keyed on lvar id
+		vector<SUBSCRIBERCALL> subscribersToCall; // Copied under the subscription lock, and called outside it
+		vector<unsigned long long> lvarSubscribedFlags; // Bitset of lvars with subscribers. SimConnect thread only
+		int nextSubscriptionToken;
+		atomic<bool> hasLvarSubscriptions;
+		atomic<bool> lvarSubscriptionsChanged;
+		CRITICAL_SECTION subscriptionMutex;
 		void (*cdaCbFunction)(void) = NULL;
 		void (*lvarCbFunctionId)(int id[], double newValue[]) = NULL;
 		void (*lvarCbFunctionName)(const char* lvarName[], double newValue[]) = NULL;
@@ -0,0 +1,111 @@
+#include "WriteQueue.h"
+
+using namespace std;
+using namespace WriteQueueMSFS;
+
+
+WriteQueue::WriteQueue()
+{
+	queued = 0;
+	coalesced = 0;
+	wakeEvent = NULL;
+	InitializeCriticalSection(&queueMutex);
+}
+
+WriteQueue::~WriteQueue()
+{
+	DeleteCriticalSection(&queueMutex);
+}
+
+void WriteQueue::pushLvar(WRITE_TYPE type, int id, double value)
+{
+	EnterCriticalSection(&queueMutex);
+	queued++;
+	auto it = runIndex.find(id);
+	if (it != runIndex.end()) {
+		// Replace the earlier write of this lvar in the current run
+		WriteOp& op = pending[it->second];
+		op.type = type;
+		op.value = value;
+		coalesced++;
+	}
+	else {
+		runIndex[id] = pending.size();
+		pending.push_back({ type, id, value, string(), vector<double>() });
+	}
+	LeaveCriticalSection(&queueMutex);
+	if (wakeEvent) SetEvent(wakeEvent);
+}
+
+void WriteQueue::pushHvar(int id)
+{
+	EnterCriticalSection(&queueMutex);
+	queued++;
+	pending.push_back({ WRITE_HVAR, id, 0.0, string(), vector<double>() });
+	runIndex.clear();
+	LeaveCriticalSection(&queueMutex);
+	if (wakeEvent) SetEvent(wakeEvent);
+}
+
+void WriteQueue::pushCalcCode(const char* code)
+{
+	EnterCriticalSection(&queueMutex);
+	queued++;
+	pending.push_back({ WRITE_CALC_CODE, 0, 0.0, string(code), vector<double>() });
+	runIndex.clear();
+	LeaveCriticalSection(&queueMutex);
+	if (wakeEvent) SetEvent(wakeEvent);
+}
+
+void WriteQueue::pushCalcCode(int handle, const double* params, int noParams)
+{
+	EnterCriticalSection(&queueMutex);
+	queued++;
+	pending.push_back({ WRITE_CALC_CODE_HANDLE, handle, 0.0, string(), vector<double>(params, params + noParams) });
+	runIndex.clear();
+	LeaveCriticalSection(&queueMutex);
+	if (wakeEvent) SetEvent(wakeEvent);
+}
+
+void WriteQueue::pushRegCalcCode(int handle, const char* code)
+{
+	EnterCriticalSection(&queueMutex);
+	queued++;
+	pending.push_back({ WRITE_REG_CALC_CODE, handle, 0.0, string(code), vector<double>() });
+	runIndex.clear();
+	LeaveCriticalSection(&queueMutex);
+	if (wakeEvent) SetEvent(wakeEvent);
+}
+
+void WriteQueue::setWakeEvent(HANDLE event)
+{
+	wakeEvent = event;
+}
+
+bool WriteQueue::take(vector<WriteOp>& ops)
+{
+	ops.clear();
+	EnterCriticalSection(&queueMutex);
+	ops.swap(pending);
+	runIndex.clear();
+	LeaveCriticalSection(&queueMutex);
+	return !ops.empty();
+}
+
+void WriteQueue::clear()
+{
+	EnterCriticalSection(&queueMutex);
+	pending.clear();
+	runIndex.clear();
+	LeaveCriticalSection(&queueMutex);
+}
+
+unsigned long long WriteQueue::getQueued()
+{
+	return queued.load();
+}
+
+unsigned long long WriteQueue::getCoalesced()
+{
+	return coalesced.load();
+}
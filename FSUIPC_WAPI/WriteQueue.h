@@ -0,0 +1,67 @@
+#pragma once
+
+#include <windows.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+using namespace std;
+
+namespace WriteQueueMSFS
+{
+	typedef enum {
+		WRITE_LVAR = 1,			// lvar set as a double, via the set lvar CDA
+		WRITE_LVAR_SHORT,		// lvar set as a short, via an event
+		WRITE_LVAR_USHORT,		// lvar set as an unsigned short, via an event
+		WRITE_HVAR,
+		WRITE_CALC_CODE,
+		WRITE_CALC_CODE_HANDLE,	// registered calc code, by handle
+		WRITE_REG_CALC_CODE,	// calc code registration for a handle, or unregistration if the code is empty
+	} WRITE_TYPE;
+
+	// Queue of outbound writes, filled by any thread and drained by the SimConnect thread.
+	// Lvar writes are coalesced per lvar id (last writer wins) within a run of lvar writes.
+	// Hvar activations and calculator code (including its registration) end the run, so that they are never re-ordered
+	// with respect to the lvar writes made before or after them.
+	class WriteQueue
+	{
+	public:
+		typedef struct _WriteOp
+		{
+			WRITE_TYPE type;
+			int id; // lvar or hvar id, or calc code handle
+			double value;
+			string calcCode;
+			vector<double> params; // calc code parameters
+		} WriteOp;
+
+		WriteQueue();
+		~WriteQueue();
+
+		// Producer interface - any thread
+		void pushLvar(WRITE_TYPE type, int id, double value);
+		void pushHvar(int id);
+		void pushCalcCode(const char* code);
+		void pushCalcCode(int handle, const double* params, int noParams);
+		void pushRegCalcCode(int handle, const char* code);
+		void setWakeEvent(HANDLE event); // Set on each push, to wake the consumer. NULL for none
+
+		// Consumer interface - SimConnect thread
+		bool take(vector<WriteOp>& ops); // Swaps out all queued writes, in order. Returns false if there were none
+		void clear();
+
+		unsigned long long getQueued();
+		unsigned long long getCoalesced();
+
+	protected:
+
+	private:
+		vector<WriteOp> pending;
+		unordered_map<int, size_t> runIndex; // lvar id to position in pending, for the current run of lvar writes
+		CRITICAL_SECTION queueMutex;
+		atomic<unsigned long long> queued;
+		atomic<unsigned long long> coalesced;
+		HANDLE wakeEvent;
+	};
+} // End of namespace
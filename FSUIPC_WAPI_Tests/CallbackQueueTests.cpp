@@ -0,0 +1,49 @@
+#include "Test.h"
+#include "CallbackQueue.h"
+
+using namespace CallbackQueueMSFS;
+
+static void testCoalesce()
+{
+	CallbackQueue queue(2, true);
+	queue.push(1, 1.0, 1);
+	queue.push(2, 2.0, 1);
+	// The ring is full, so these go into the overflow map. Only the replaced update is coalesced
+	queue.push(3, 3.0, 1);
+	queue.push(4, 4.0, 1);
+	CHECK(queue.getCoalesced() == 0);
+	queue.push(3, 30.0, 2);
+	CHECK(queue.getCoalesced() == 1);
+	CHECK(queue.getDropped() == 0);
+
+	map<int, CallbackQueue::QueueEntry> overflow;
+	CHECK(!queue.takeOverflow(overflow)); // The ring must be drained first
+	CallbackQueue::QueueEntry entry;
+	CHECK(queue.pop(entry) && entry.id == 1);
+	CHECK(queue.pop(entry) && entry.id == 2);
+	CHECK(!queue.pop(entry));
+	CHECK(queue.takeOverflow(overflow));
+	CHECK(overflow.size() == 2);
+	CHECK(overflow[3].value == 30.0 && overflow[3].targets == 3);
+	CHECK(overflow[4].value == 4.0);
+}
+
+static void testDropOldest()
+{
+	CallbackQueue queue(2, false);
+	queue.push(1, 1.0, 1);
+	queue.push(2, 2.0, 1);
+	queue.push(3, 3.0, 1);
+	CHECK(queue.getDropped() == 1);
+	CHECK(queue.getCoalesced() == 0);
+	CallbackQueue::QueueEntry entry;
+	CHECK(queue.pop(entry) && entry.id == 2);
+	CHECK(queue.pop(entry) && entry.id == 3);
+	CHECK(!queue.pop(entry));
+}
+
+void testCallbackQueue()
+{
+	testCoalesce();
+	testDropOldest();
+}
@@ -0,0 +1,492 @@
+#include "FakeSimConnect.h"
+#include <SimConnect.h>
+#include <map>
+#include <memory>
+#include "Test.h"
+
+namespace FakeSimConnectMSFS
+{
+	typedef struct _FakeCDA
+	{
+		vector<char> data;
+		bool set; // Written at least once
+	} FakeCDA;
+
+	typedef struct _FakeRequest
+	{
+		string cdaName;
+		DWORD requestId;
+		DWORD defineId;
+		SIMCONNECT_CLIENT_DATA_PERIOD period;
+		DWORD flags;
+		vector<char> lastDelivered; // For SIMCONNECT_CLIENT_DATA_REQUEST_FLAG_CHANGED
+		bool delivered;
+	} FakeRequest;
+
+	typedef struct _FakeConnection
+	{
+		HANDLE hEvent; // NULL once closed
+		map<DWORD, string> cdaNames; // Keyed on client data id
+		map<DWORD, DWORD> definitionSizes; // Keyed on definition id
+		map<DWORD, int> eventNos; // FAKE_WASM_EVENT, keyed on client event id
+		vector<FakeRequest> requests;
+		vector<vector<char>> inbox; // Messages not yet dispatched
+	} FakeConnection;
+
+	static struct _FakeState
+	{
+		_FakeState() { InitializeCriticalSection(&mutex); }
+		CRITICAL_SECTION mutex; // Guards everything here: the client calls SimConnect from several threads
+		int supportedProtocolFlags = 0;
+		int protocolFlags = 0;
+		int noLvars = 0;
+		int noHvars = 0;
+		map<string, FakeCDA> cdas; // Keyed on name
+		vector<double> lvarValues;
+		vector<unique_ptr<FakeConnection>> connections; // Kept (closed) until reset, as the client may still hold the handle
+		vector<FakeWrite> writes;
+		vector<FakeEvent> events;
+		size_t messagesSent = 0;
+		DWORD lastPacketId = 0;
+	} state;
+
+	static const char* const LVAR_CDA_NAME = "FSUIPC_LVARS%d";
+	static const char* const HVAR_CDA_NAME = "FSUIPC_HVARS%d";
+	static const char* const VALUE_CDA_NAME = "FSUIPC_VALUES%d";
+	static const char* const DELTA_CDA_NAME = "FSUIPC_DELTA";
+	static const int NO_NAMES_PER_CDA = 8192 / sizeof(CDAName);
+	static const int NO_VALUES_PER_CDA = 8192 / sizeof(CDAValue);
+
+
+	static void queueMessage(FakeConnection* connection, FakeRequest& request, const vector<char>& data)
+	{
+		// Client data is received as a SIMCONNECT_RECV_CLIENT_DATA header, with the data starting at dwData
+		SIMCONNECT_RECV_CLIENT_DATA header = {};
+		size_t dataOffset = (char*)&header.dwData - (char*)&header;
+		size_t size = data.size();
+		auto definition = connection->definitionSizes.find(request.defineId);
+		if (definition != connection->definitionSizes.end() && definition->second < size) size = definition->second;
+
+		header.dwSize = (DWORD)(dataOffset + size);
+		header.dwID = SIMCONNECT_RECV_ID_CLIENT_DATA;
+		header.dwRequestID = request.requestId;
+		header.dwDefineID = request.defineId;
+		header.dwentrynumber = 1;
+		header.dwoutof = 1;
+		header.dwDefineCount = 1;
+		vector<char> message(dataOffset + size > sizeof(header) ? dataOffset + size : sizeof(header));
+		memcpy(message.data(), &header, dataOffset);
+		memcpy(message.data() + dataOffset, data.data(), size);
+		connection->inbox.push_back(move(message));
+		state.messagesSent++;
+		request.lastDelivered = data;
+		request.delivered = true;
+		SetEvent(connection->hEvent);
+	}
+
+
+	static bool isDue(const FakeRequest& request, const vector<char>& data)
+	{
+		return !(request.flags & SIMCONNECT_CLIENT_DATA_REQUEST_FLAG_CHANGED) || !request.delivered || request.lastDelivered != data;
+	}
+
+
+	static void publish(const string& cdaName)
+	{
+		// Sends the CDA to the requests made to receive it when set
+		FakeCDA& cda = state.cdas[cdaName];
+		cda.set = true;
+		for (auto& connection : state.connections) {
+			if (!connection->hEvent) continue;
+			for (FakeRequest& request : connection->requests) {
+				if (request.cdaName != cdaName || request.period != SIMCONNECT_CLIENT_DATA_PERIOD_ON_SET) continue;
+				if (isDue(request, cda.data)) queueMessage(connection.get(), request, cda.data);
+			}
+		}
+	}
+
+
+	static string getCDAName(const char* format, int index)
+	{
+		char name[MAX_CDA_NAME_SIZE];
+		sprintf_s(name, sizeof(name), format, index);
+		return name;
+	}
+
+
+	static void writeConfig()
+	{
+		// Lvar name CDAs, then hvar name CDAs, then the value CDAs and the delta CDA, sized for what they hold
+		CONFIG_CDA config = {};
+		int noCDAs = 0;
+		auto addCDA = [&](const string& name, int size, CDAType type) {
+			strcpy_s(config.CDA_Names[noCDAs], MAX_CDA_NAME_SIZE, name.c_str());
+			config.CDA_Size[noCDAs] = size;
+			config.CDA_Type[noCDAs] = type;
+			noCDAs++;
+		};
+		strcpy_s(config.version, sizeof(config.version), WASM_VERSION);
+		for (int i = 0; i * NO_NAMES_PER_CDA < state.noLvars; i++)
+			addCDA(getCDAName(LVAR_CDA_NAME, i), min(NO_NAMES_PER_CDA, state.noLvars - i * NO_NAMES_PER_CDA) * (int)sizeof(CDAName), LVARF);
+		for (int i = 0; i * NO_NAMES_PER_CDA < state.noHvars; i++)
+			addCDA(getCDAName(HVAR_CDA_NAME, i), min(NO_NAMES_PER_CDA, state.noHvars - i * NO_NAMES_PER_CDA) * (int)sizeof(CDAName), HVARF);
+		for (int i = 0; i * NO_VALUES_PER_CDA < state.noLvars; i++)
+			addCDA(getCDAName(VALUE_CDA_NAME, i), min(NO_VALUES_PER_CDA, state.noLvars - i * NO_VALUES_PER_CDA) * (int)sizeof(CDAValue), VALUEF);
+		if (state.supportedProtocolFlags & PROTOCOL_DELTA_VALUES) addCDA(DELTA_CDA_NAME, (int)sizeof(CDADELTA), DELTAF);
+		config.protocolFlags = state.protocolFlags;
+
+		FakeCDA& cda = state.cdas[CONFIG_CDA_NAME];
+		cda.data.assign((char*)&config, (char*)&config + sizeof(config));
+		publish(CONFIG_CDA_NAME);
+	}
+
+
+	static void writeNames(const char* format, const char* prefix, int noNames)
+	{
+		for (int i = 0; i * NO_NAMES_PER_CDA < noNames; i++) {
+			int noItems = min(NO_NAMES_PER_CDA, noNames - i * NO_NAMES_PER_CDA);
+			vector<char> data(noItems * sizeof(CDAName));
+			CDAName* names = (CDAName*)data.data();
+			for (int j = 0; j < noItems; j++) sprintf_s(names[j].name, MAX_VAR_NAME_SIZE, "%s%d", prefix, i * NO_NAMES_PER_CDA + j);
+			string name = getCDAName(format, i);
+			state.cdas[name].data = move(data);
+			publish(name);
+		}
+	}
+
+
+	static void writeValues(int firstId, int noValues, bool send)
+	{
+		// Rewrites the value CDAs that hold the given lvars
+		for (int i = firstId / NO_VALUES_PER_CDA; i * NO_VALUES_PER_CDA < firstId + noValues; i++) {
+			int first = i * NO_VALUES_PER_CDA;
+			int noItems = min(NO_VALUES_PER_CDA, state.noLvars - first);
+			string name = getCDAName(VALUE_CDA_NAME, i);
+			FakeCDA& cda = state.cdas[name];
+			cda.data.assign((char*)(state.lvarValues.data() + first), (char*)(state.lvarValues.data() + first + noItems));
+			if (send) publish(name);
+			else cda.set = true;
+		}
+	}
+
+
+	void resetFakeWasm(int supportedProtocolFlags)
+	{
+		EnterCriticalSection(&state.mutex);
+		state.supportedProtocolFlags = supportedProtocolFlags;
+		state.protocolFlags = 0;
+		state.noLvars = 0;
+		state.noHvars = 0;
+		state.cdas.clear();
+		state.lvarValues.clear();
+		state.connections.clear();
+		state.writes.clear();
+		state.events.clear();
+		state.messagesSent = 0;
+		// An empty config, as before the WASM has loaded the lvars
+		writeConfig();
+		LeaveCriticalSection(&state.mutex);
+	}
+
+
+	void loadFakeWasm(int noLvars, int noHvars)
+	{
+		EnterCriticalSection(&state.mutex);
+		state.noLvars = noLvars;
+		state.noHvars = noHvars;
+		state.lvarValues.resize(noLvars, 0.0);
+		writeConfig();
+		writeNames(LVAR_CDA_NAME, "Lvar", noLvars);
+		writeNames(HVAR_CDA_NAME, "H:Hvar", noHvars);
+		if (noLvars) writeValues(0, noLvars, true);
+		LeaveCriticalSection(&state.mutex);
+	}
+
+
+	void setFakeLvars(int firstId, const double* values, int noValues)
+	{
+		EnterCriticalSection(&state.mutex);
+		if (firstId >= 0 && firstId + noValues <= state.noLvars && noValues > 0) {
+			memcpy(&state.lvarValues[firstId], values, noValues * sizeof(double));
+			writeValues(firstId, noValues, true);
+		}
+		LeaveCriticalSection(&state.mutex);
+	}
+
+
+	void sendFakeDelta(const int* ids, const double* values, int noItems)
+	{
+		EnterCriticalSection(&state.mutex);
+		CDADELTA delta = {};
+		for (int i = 0; i < noItems && delta.noItems < MAX_NO_DELTA_ITEMS; i++) {
+			if (ids[i] < 0 || ids[i] >= state.noLvars) continue;
+			state.lvarValues[ids[i]] = values[i];
+			writeValues(ids[i], 1, false);
+			delta.items[delta.noItems++] = { ids[i], values[i] };
+		}
+		state.cdas[DELTA_CDA_NAME].data.assign((char*)&delta, (char*)&delta + sizeof(delta));
+		publish(DELTA_CDA_NAME);
+		LeaveCriticalSection(&state.mutex);
+	}
+
+
+	int getFakeProtocolFlags()
+	{
+		EnterCriticalSection(&state.mutex);
+		int flags = state.protocolFlags;
+		LeaveCriticalSection(&state.mutex);
+		return flags;
+	}
+
+
+	vector<FakeWrite> takeFakeWrites()
+	{
+		vector<FakeWrite> writes;
+		EnterCriticalSection(&state.mutex);
+		writes.swap(state.writes);
+		LeaveCriticalSection(&state.mutex);
+		return writes;
+	}
+
+
+	vector<FakeEvent> takeFakeEvents()
+	{
+		vector<FakeEvent> events;
+		EnterCriticalSection(&state.mutex);
+		events.swap(state.events);
+		LeaveCriticalSection(&state.mutex);
+		return events;
+	}
+
+
+	size_t getFakeMessagesSent()
+	{
+		EnterCriticalSection(&state.mutex);
+		size_t messagesSent = state.messagesSent;
+		LeaveCriticalSection(&state.mutex);
+		return messagesSent;
+	}
+
+
+	bool waitFor(function<bool()> condition, DWORD timeout)
+	{
+		ULONGLONG deadline = GetTickCount64() + timeout;
+		while (!condition()) {
+			if (GetTickCount64() >= deadline) return false;
+			Sleep(1);
+		}
+		return true;
+	}
+
+
+	static FakeConnection* getConnection(HANDLE hSimConnect)
+	{
+		// Called under the lock
+		for (auto& connection : state.connections) {
+			if (connection.get() == hSimConnect) return connection->hEvent ? connection.get() : NULL;
+		}
+		return NULL;
+	}
+} // End of namespace
+
+using namespace FakeSimConnectMSFS;
+
+// The SimConnect functions used by the WAPI, in place of those of SimConnect.lib
+
+SIMCONNECTAPI SimConnect_Open(HANDLE* phSimConnect, LPCSTR szName, HWND hWnd, DWORD UserEventWin32, HANDLE hEventHandle, DWORD ConfigIndex)
+{
+	EnterCriticalSection(&state.mutex);
+	FakeConnection* connection = new FakeConnection();
+	connection->hEvent = hEventHandle;
+	state.connections.emplace_back(connection);
+	*phSimConnect = connection;
+	LeaveCriticalSection(&state.mutex);
+	return S_OK;
+}
+
+
+SIMCONNECTAPI SimConnect_Close(HANDLE hSimConnect)
+{
+	EnterCriticalSection(&state.mutex);
+	FakeConnection* connection = getConnection(hSimConnect);
+	if (connection) {
+		// The client closes its event handle after this
+		connection->hEvent = NULL;
+		connection->requests.clear();
+		connection->inbox.clear();
+	}
+	LeaveCriticalSection(&state.mutex);
+	return connection ? S_OK : E_FAIL;
+}
+
+
+SIMCONNECTAPI SimConnect_CallDispatch(HANDLE hSimConnect, DispatchProc pfcnDispatch, void* pContext)
+{
+	vector<vector<char>> messages;
+	EnterCriticalSection(&state.mutex);
+	FakeConnection* connection = getConnection(hSimConnect);
+	if (connection) messages.swap(connection->inbox);
+	LeaveCriticalSection(&state.mutex);
+	if (!connection) return E_FAIL;
+
+	// Dispatched outside the lock, as the handler calls back into SimConnect
+	for (vector<char>& message : messages) pfcnDispatch((SIMCONNECT_RECV*)message.data(), (DWORD)message.size(), pContext);
+	return S_OK;
+}
+
+
+SIMCONNECTAPI SimConnect_GetLastSentPacketID(HANDLE hSimConnect, DWORD* pdwError)
+{
+	EnterCriticalSection(&state.mutex);
+	*pdwError = state.lastPacketId;
+	LeaveCriticalSection(&state.mutex);
+	return S_OK;
+}
+
+
+SIMCONNECTAPI SimConnect_MapClientEventToSimEvent(HANDLE hSimConnect, SIMCONNECT_CLIENT_EVENT_ID EventID, const char* EventName)
+{
+	// The WAPI maps its events to "#0x<start event no + event no>"
+	unsigned int simEventNo;
+	if (sscanf_s(EventName, "#0x%x", &simEventNo) != 1) return E_INVALIDARG;
+	EnterCriticalSection(&state.mutex);
+	FakeConnection* connection = getConnection(hSimConnect);
+	if (connection) connection->eventNos[EventID] = (int)(simEventNo - EVENT_START_NO);
+	state.lastPacketId++;
+	LeaveCriticalSection(&state.mutex);
+	return connection ? S_OK : E_FAIL;
+}
+
+
+SIMCONNECTAPI SimConnect_TransmitClientEvent(HANDLE hSimConnect, SIMCONNECT_OBJECT_ID ObjectID, SIMCONNECT_CLIENT_EVENT_ID EventID, DWORD dwData, SIMCONNECT_NOTIFICATION_GROUP_ID GroupID, SIMCONNECT_EVENT_FLAG Flags)
+{
+	EnterCriticalSection(&state.mutex);
+	FakeConnection* connection = getConnection(hSimConnect);
+	auto eventNo = connection ? connection->eventNos.find(EventID) : map<DWORD, int>::iterator();
+	bool mapped = connection && eventNo != connection->eventNos.end();
+	if (mapped) {
+		state.events.push_back({ eventNo->second, dwData, benchTime() });
+		state.lastPacketId++;
+		if (eventNo->second == FAKE_EVENT_SET_PROTOCOL) {
+			state.protocolFlags = (int)dwData & state.supportedProtocolFlags;
+			writeConfig();
+		}
+	}
+	LeaveCriticalSection(&state.mutex);
+	return mapped ? S_OK : E_FAIL;
+}
+
+
+SIMCONNECTAPI SimConnect_SetNotificationGroupPriority(HANDLE hSimConnect, SIMCONNECT_NOTIFICATION_GROUP_ID GroupID, DWORD uPriority)
+{
+	return S_OK;
+}
+
+
+SIMCONNECTAPI SimConnect_MapClientDataNameToID(HANDLE hSimConnect, const char* szClientDataName, SIMCONNECT_CLIENT_DATA_ID ClientDataID)
+{
+	EnterCriticalSection(&state.mutex);
+	FakeConnection* connection = getConnection(hSimConnect);
+	if (connection) connection->cdaNames[ClientDataID] = szClientDataName;
+	state.lastPacketId++;
+	LeaveCriticalSection(&state.mutex);
+	return connection ? S_OK : E_FAIL;
+}
+
+
+SIMCONNECTAPI SimConnect_CreateClientData(HANDLE hSimConnect, SIMCONNECT_CLIENT_DATA_ID ClientDataID, DWORD dwSize, SIMCONNECT_CREATE_CLIENT_DATA_FLAG Flags)
+{
+	EnterCriticalSection(&state.mutex);
+	FakeConnection* connection = getConnection(hSimConnect);
+	auto name = connection ? connection->cdaNames.find(ClientDataID) : map<DWORD, string>::iterator();
+	bool mapped = connection && name != connection->cdaNames.end();
+	if (mapped && !state.cdas.count(name->second)) state.cdas[name->second].data.resize(dwSize);
+	state.lastPacketId++;
+	LeaveCriticalSection(&state.mutex);
+	return mapped ? S_OK : E_FAIL;
+}
+
+
+SIMCONNECTAPI SimConnect_AddToClientDataDefinition(HANDLE hSimConnect, SIMCONNECT_CLIENT_DATA_DEFINITION_ID DefineID, DWORD dwOffset, DWORD dwSizeOrType, float fEpsilon, DWORD DatumID)
+{
+	EnterCriticalSection(&state.mutex);
+	FakeConnection* connection = getConnection(hSimConnect);
+	if (connection) connection->definitionSizes[DefineID] += dwSizeOrType;
+	LeaveCriticalSection(&state.mutex);
+	return connection ? S_OK : E_FAIL;
+}
+
+
+SIMCONNECTAPI SimConnect_ClearClientDataDefinition(HANDLE hSimConnect, SIMCONNECT_CLIENT_DATA_DEFINITION_ID DefineID)
+{
+	EnterCriticalSection(&state.mutex);
+	FakeConnection* connection = getConnection(hSimConnect);
+	if (connection) {
+		connection->definitionSizes.erase(DefineID);
+		for (size_t i = connection->requests.size(); i-- > 0; ) {
+			if (connection->requests[i].defineId == DefineID) connection->requests.erase(connection->requests.begin() + i);
+		}
+	}
+	LeaveCriticalSection(&state.mutex);
+	return connection ? S_OK : E_FAIL;
+}
+
+
+SIMCONNECTAPI SimConnect_RequestClientData(HANDLE hSimConnect, SIMCONNECT_CLIENT_DATA_ID ClientDataID, SIMCONNECT_DATA_REQUEST_ID RequestID, SIMCONNECT_CLIENT_DATA_DEFINITION_ID DefineID, SIMCONNECT_CLIENT_DATA_PERIOD Period, SIMCONNECT_CLIENT_DATA_REQUEST_FLAG Flags, DWORD origin, DWORD interval, DWORD limit)
+{
+	EnterCriticalSection(&state.mutex);
+	FakeConnection* connection = getConnection(hSimConnect);
+	auto name = connection ? connection->cdaNames.find(ClientDataID) : map<DWORD, string>::iterator();
+	bool mapped = connection && name != connection->cdaNames.end();
+	if (mapped) {
+		// A request replaces the previous request with the same id. What was last delivered is kept, so a
+		// changed-only request for the same CDA is not sent data the client already has
+		FakeRequest request = { name->second, RequestID, DefineID, Period, Flags, {}, false };
+		size_t i = 0;
+		for (; i < connection->requests.size() && connection->requests[i].requestId != RequestID; i++);
+		if (i < connection->requests.size()) {
+			if (connection->requests[i].cdaName == request.cdaName) {
+				request.lastDelivered.swap(connection->requests[i].lastDelivered);
+				request.delivered = connection->requests[i].delivered;
+			}
+			connection->requests[i] = move(request);
+		}
+		else connection->requests.push_back(move(request));
+
+		// Send the current data now if requested once, or if it has been set and the client has not had it yet
+		auto cda = state.cdas.find(name->second);
+		FakeRequest& added = connection->requests[i];
+		if (cda != state.cdas.end()) {
+			if (Period == SIMCONNECT_CLIENT_DATA_PERIOD_ONCE) {
+				queueMessage(connection, added, cda->second.data);
+				connection->requests.erase(connection->requests.begin() + i);
+			}
+			else if (Period == SIMCONNECT_CLIENT_DATA_PERIOD_ON_SET && (Flags & SIMCONNECT_CLIENT_DATA_REQUEST_FLAG_CHANGED) &&
+					cda->second.set && isDue(added, cda->second.data))
+				queueMessage(connection, added, cda->second.data);
+		}
+		state.lastPacketId++;
+	}
+	LeaveCriticalSection(&state.mutex);
+	return mapped ? S_OK : E_FAIL;
+}
+
+
+SIMCONNECTAPI SimConnect_SetClientData(HANDLE hSimConnect, SIMCONNECT_CLIENT_DATA_ID ClientDataID, SIMCONNECT_CLIENT_DATA_DEFINITION_ID DefineID, SIMCONNECT_CLIENT_DATA_SET_FLAG Flags, DWORD dwReserved, DWORD cbUnitSize, void* pDataSet)
+{
+	EnterCriticalSection(&state.mutex);
+	FakeConnection* connection = getConnection(hSimConnect);
+	auto name = connection ? connection->cdaNames.find(ClientDataID) : map<DWORD, string>::iterator();
+	bool mapped = connection && name != connection->cdaNames.end();
+	if (mapped) {
+		FakeWrite write = { name->second, (int)DefineID, vector<char>((char*)pDataSet, (char*)pDataSet + cbUnitSize), benchTime() };
+		FakeCDA& cda = state.cdas[name->second];
+		if (cda.data.size() < cbUnitSize) cda.data.resize(cbUnitSize);
+		memcpy(cda.data.data(), pDataSet, cbUnitSize);
+		cda.set = true;
+		state.writes.push_back(move(write));
+		state.lastPacketId++;
+	}
+	LeaveCriticalSection(&state.mutex);
+	return mapped ? S_OK : E_FAIL;
+}
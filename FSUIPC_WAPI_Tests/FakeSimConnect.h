@@ -0,0 +1,58 @@
+#pragma once
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include "WASM.h"
+
+using namespace std;
+using namespace WASM;
+
+namespace FakeSimConnectMSFS
+{
+	// Stand-in for SimConnect and the WASM module, so that WASMIF can be tested without MSFS.
+	// FakeSimConnect.cpp defines the SimConnect_ functions that WASMIF uses: client data areas are
+	// held in memory by name, requests are answered from them, and messages are queued per
+	// connection and delivered by SimConnect_CallDispatch on the thread that calls it.
+	// The functions here play the part of the WASM: they create and write the CDAs, and record
+	// the writes and events received from the client.
+
+	// Event numbers of the WASM, relative to the start event number (see WASMIF.cpp)
+	enum FAKE_WASM_EVENT
+	{
+		FAKE_EVENT_SET_LVAR = 1,
+		FAKE_EVENT_SET_HVAR = 2,
+		FAKE_EVENT_UPDATE_CDAS = 3,
+		FAKE_EVENT_SET_LVARS = 6,
+		FAKE_EVENT_SET_PROTOCOL = 7,
+		FAKE_EVENT_EXEC_CALC_CODE = 8,
+	};
+
+	typedef struct _FakeWrite
+	{
+		string cdaName;
+		int defineId;
+		vector<char> data;
+		double time; // benchTime() when received
+	} FakeWrite;
+
+	typedef struct _FakeEvent
+	{
+		int eventNo; // FAKE_WASM_EVENT
+		DWORD data;
+		double time;
+	} FakeEvent;
+
+	void resetFakeWasm(int supportedProtocolFlags); // Drops all CDAs, connections and records. The protocol flags in use are those both sides support
+	void loadFakeWasm(int noLvars, int noHvars); // (Re)loads the WASM with lvars named "Lvar<id>" and hvars named "H:Hvar<id>": writes the config, name and value CDAs
+	void setFakeLvars(int firstId, const double* values, int noValues); // Writes the values to the value CDAs
+	void sendFakeDelta(const int* ids, const double* values, int noItems); // Writes the values to the delta CDA (and, without sending them, to the value CDAs)
+	int getFakeProtocolFlags(); // Flags in use, once the client has sent its flags
+
+	vector<FakeWrite> takeFakeWrites(); // Returns (and clears) the client data writes received
+	vector<FakeEvent> takeFakeEvents(); // Returns (and clears) the events received
+	size_t getFakeMessagesSent(); // Number of messages queued to the client
+
+	bool waitFor(function<bool()> condition, DWORD timeout); // Polls the condition until it is true (returns true) or timeout ms have passed
+} // End of namespace
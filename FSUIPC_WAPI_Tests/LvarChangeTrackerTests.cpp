@@ -0,0 +1,162 @@
+#include "Test.h"
+#include "LvarChangeTracker.h"
+#include <set>
+
+using namespace LvarChangeTrackerMSFS;
+
+// Polls until no more changes are returned, collecting the ids. Returns the number of calls made
+static int drain(LvarChangeTracker& tracker, LvarChangeCursor& cursor, size_t maxIds, multiset<int>& seen)
+{
+	vector<int> ids(maxIds);
+	int calls = 0;
+	for (;;) {
+		LvarChangeCursor next;
+		size_t noIds = tracker.getChangedSince(cursor, ids.data(), maxIds, next);
+		cursor = next;
+		if (noIds == 0) break;
+		CHECK(noIds <= maxIds);
+		seen.insert(ids.begin(), ids.begin() + noIds);
+		if (++calls > 1000) {
+			CHECK(!"getChangedSince did not make progress");
+			break;
+		}
+	}
+	return calls;
+}
+
+static void testGenerationLargerThanBuffer(size_t journalSize)
+{
+	LvarChangeTracker tracker(journalSize);
+	tracker.resize(3000);
+	LvarChangeCursor cursor = { tracker.getGeneration(), -1 };
+
+	// One update changing more lvars than fit in the ids buffer
+	tracker.beginUpdate();
+	for (int id = 0; id < 2000; id++) tracker.markChanged(id);
+	tracker.endUpdate();
+
+	multiset<int> seen;
+	int calls = drain(tracker, cursor, 512, seen);
+	CHECK(calls == 4);
+	CHECK(seen.size() == 2000);
+	CHECK(set<int>(seen.begin(), seen.end()).size() == 2000);
+	CHECK(*seen.begin() == 0 && *seen.rbegin() == 1999);
+	CHECK(cursor.generation == tracker.getGeneration() && cursor.lastId == -1);
+}
+
+static void testInitialScan()
+{
+	LvarChangeTracker tracker(4096);
+	tracker.resize(3000);
+	LvarChangeCursor cursor = { 0, -1 };
+	multiset<int> seen;
+	drain(tracker, cursor, 1000, seen);
+	CHECK(seen.size() == 3000);
+	CHECK(set<int>(seen.begin(), seen.end()).size() == 3000);
+}
+
+static void testChangesWhileDraining()
+{
+	LvarChangeTracker tracker(4096);
+	tracker.resize(100);
+	LvarChangeCursor cursor = { tracker.getGeneration(), -1 };
+	tracker.beginUpdate();
+	for (int id = 0; id < 100; id++) tracker.markChanged(id);
+	tracker.endUpdate();
+
+	vector<int> ids(40);
+	LvarChangeCursor next;
+	size_t noIds = tracker.getChangedSince(cursor, ids.data(), ids.size(), next);
+	CHECK(noIds == 40 && ids[0] == 0 && ids[39] == 39);
+	cursor = next;
+
+	// An lvar already returned and one not yet returned change again before the next poll:
+	// both are reported (once) with the later generation
+	tracker.beginUpdate();
+	tracker.markChanged(10);
+	tracker.markChanged(70);
+	tracker.endUpdate();
+
+	multiset<int> seen;
+	drain(tracker, cursor, 40, seen);
+	CHECK(seen.size() == 61);
+	CHECK(seen.count(10) == 1 && seen.count(70) == 1 && seen.count(39) == 0 && seen.count(40) == 1);
+}
+
+static void testShrink()
+{
+	// An incremental reload keeps fewer lvars: journal entries for the dropped ids must not be used
+	LvarChangeTracker tracker(4096);
+	tracker.resize(100);
+	LvarChangeCursor before = { tracker.getGeneration(), -1 };
+	tracker.beginUpdate();
+	for (int id = 40; id < 100; id++) tracker.markChanged(id);
+	tracker.endUpdate();
+	LvarChangeCursor afterUpdate = { tracker.getGeneration(), -1 };
+
+	tracker.resize(50);
+	multiset<int> seen;
+	drain(tracker, before, 64, seen);
+	CHECK(seen.size() == 10 && *seen.begin() == 40 && *seen.rbegin() == 49);
+
+	// Changes after the shrink are still reported from the journal
+	const LvarChangeCursor shrinkPoint = { tracker.getGeneration(), -1 };
+	LvarChangeCursor afterShrink = shrinkPoint;
+	tracker.beginUpdate();
+	tracker.markChanged(10);
+	tracker.markChanged(60); // No longer exists
+	tracker.endUpdate();
+	seen.clear();
+	drain(tracker, afterShrink, 64, seen);
+	CHECK(seen.size() == 1 && seen.count(10) == 1);
+	seen.clear();
+	drain(tracker, afterUpdate, 64, seen);
+	CHECK(seen.size() == 1 && seen.count(10) == 1);
+
+	// Growing again reports the new lvars, but not the old changes to the dropped ids
+	tracker.resize(100);
+	seen.clear();
+	LvarChangeCursor afterRegrow = { tracker.getGeneration(), -1 };
+	afterShrink = shrinkPoint;
+	drain(tracker, afterShrink, 128, seen);
+	CHECK(seen.size() == 51 && seen.count(10) == 1 && seen.count(99) == 1);
+	seen.clear();
+	drain(tracker, afterRegrow, 128, seen);
+	CHECK(seen.empty());
+}
+
+static void testUpdateInProgress()
+{
+	// A poll during an update sees neither its changes nor an earlier change hidden by it, and
+	// reports both once the update has ended
+	LvarChangeTracker tracker(4096);
+	tracker.resize(10);
+	LvarChangeCursor cursor = { tracker.getGeneration(), -1 };
+	tracker.beginUpdate();
+	tracker.markChanged(1);
+	tracker.markChanged(2);
+	tracker.endUpdate();
+
+	tracker.beginUpdate();
+	tracker.markChanged(2);
+	tracker.markChanged(3);
+	multiset<int> seen;
+	drain(tracker, cursor, 8, seen);
+	CHECK(seen.size() == 1 && seen.count(1) == 1);
+	CHECK(cursor.generation == tracker.getGeneration());
+	tracker.endUpdate();
+
+	seen.clear();
+	drain(tracker, cursor, 8, seen);
+	CHECK(seen.size() == 2 && seen.count(2) == 1 && seen.count(3) == 1);
+}
+
+void testLvarChangeTracker()
+{
+	testGenerationLargerThanBuffer(4096);
+	testGenerationLargerThanBuffer(1000); // Journal overrun, so the stamps are scanned
+	testInitialScan();
+	testChangesWhileDraining();
+	testShrink();
+	testUpdateInProgress();
+}
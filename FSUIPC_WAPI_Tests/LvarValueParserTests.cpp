@@ -0,0 +1,106 @@
+#include "Test.h"
+#include "LvarValueParser.h"
+#include <stdlib.h>
+#include <string.h>
+
+using namespace LvarValueParserMSFS;
+
+static LVAR_VALUE_TYPE parse(const char* value, double& number)
+{
+	return parseLvarValue(value, strlen(value), number);
+}
+
+static void testIntegers()
+{
+	double number;
+	CHECK(parse("42", number) == LVAR_VALUE_UNSIGNED_SHORT && number == 42.0);
+	CHECK(parse("+42", number) == LVAR_VALUE_UNSIGNED_SHORT && number == 42.0);
+	CHECK(parse("-42", number) == LVAR_VALUE_SHORT && number == -42.0);
+	CHECK(parse("0", number) == LVAR_VALUE_SHORT && number == 0.0);
+	CHECK(parse("65536", number) == LVAR_VALUE_DOUBLE && number == 65536.0);
+	CHECK(parse("-32769", number) == LVAR_VALUE_DOUBLE && number == -32769.0);
+}
+
+static void testWhitespace()
+{
+	double number;
+	CHECK(parse(" 42", number) == LVAR_VALUE_UNSIGNED_SHORT && number == 42.0);
+	CHECK(parse("42 ", number) == LVAR_VALUE_UNSIGNED_SHORT && number == 42.0);
+	CHECK(parse("\t-1.5\r\n", number) == LVAR_VALUE_DOUBLE && number == -1.5);
+	CHECK(parse("  ", number) == LVAR_VALUE_STRING);
+	CHECK(parse("4 2", number) == LVAR_VALUE_STRING);
+}
+
+static void testHex()
+{
+	double number;
+	CHECK(parse("0x10", number) == LVAR_VALUE_DOUBLE && number == 16.0);
+	CHECK(parse("0XfF", number) == LVAR_VALUE_DOUBLE && number == 255.0);
+	CHECK(parse(" -0x10 ", number) == LVAR_VALUE_DOUBLE && number == -16.0);
+	CHECK(parse("0x1.8p1", number) == LVAR_VALUE_DOUBLE && number == 3.0);
+	CHECK(parse("0x", number) == LVAR_VALUE_STRING);
+	CHECK(parse("0xg", number) == LVAR_VALUE_STRING);
+}
+
+static void testOthers()
+{
+	double number;
+	CHECK(parse("1.25", number) == LVAR_VALUE_DOUBLE && number == 1.25);
+	CHECK(parse("1e3", number) == LVAR_VALUE_DOUBLE && number == 1000.0);
+	CHECK(parse("-inf", number) == LVAR_VALUE_DOUBLE && number < 0 && number * 0 != 0);
+	CHECK(parse("abc", number) == LVAR_VALUE_STRING && number == 0.0);
+	CHECK(parse("+-1", number) == LVAR_VALUE_STRING);
+	CHECK(parse("--1", number) == LVAR_VALUE_STRING);
+	CHECK(parse("", number) == LVAR_VALUE_STRING);
+}
+
+void testLvarValueParser()
+{
+	testIntegers();
+	testWhitespace();
+	testHex();
+	testOthers();
+}
+
+
+void benchLvarValueParser()
+{
+	// A mix of the values macros send, through the parser and through the two-pass parse it replaced:
+	// strtod, then sscanf "%d%n" and strlen to see if the value is an integer
+	const char* values[] = { "1", "0", "-1", "255", "16384", "-200", "0.5", "1013.25", "-0.001", "1e3", "ON", "OFF" };
+	const int noValues = sizeof(values) / sizeof(values[0]);
+	size_t lengths[noValues];
+	for (int i = 0; i < noValues; i++) lengths[i] = strlen(values[i]);
+	const int rounds = 100000;
+
+	int counts[5] = { 0 };
+	double start = benchTime();
+	for (int round = 0; round < rounds; round++) {
+		for (int i = 0; i < noValues; i++) {
+			double number;
+			counts[parseLvarValue(values[i], lengths[i], number)]++;
+		}
+	}
+	double parserTime = benchTime() - start;
+
+	start = benchTime();
+	for (int round = 0; round < rounds; round++) {
+		for (int i = 0; i < noValues; i++) {
+			char* p;
+			double converted = strtod(values[i], &p);
+			if (*p) counts[LVAR_VALUE_STRING]--;
+			else {
+				int integer, r, n;
+				r = sscanf_s(values[i], "%d%n", &integer, &n);
+				if (r == 1 && n == strlen(values[i])) counts[converted > 0 && converted < 65536 ? LVAR_VALUE_UNSIGNED_SHORT : LVAR_VALUE_SHORT]--;
+				else counts[LVAR_VALUE_DOUBLE]--;
+			}
+		}
+	}
+	double twoPassTime = benchTime() - start;
+
+	bool mismatch = counts[1] || counts[2] || counts[3] || counts[4];
+	double noParses = (double)rounds * noValues;
+	printf("LvarValueParser: parseLvarValue %6.1f ns/value, strtod + sscanf %6.1f ns/value%s\n",
+		parserTime * 1e9 / noParses, twoPassTime * 1e9 / noParses, mismatch ? " (MISMATCH)" : "");
+}
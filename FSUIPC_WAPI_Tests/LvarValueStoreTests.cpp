@@ -0,0 +1,125 @@
+#include "Test.h"
+#include "LvarValueStore.h"
+#include <atomic>
+#include <thread>
+
+using namespace LvarValueStoreMSFS;
+
+static void writeBlock(LvarValueStore& store, int noValues, double value)
+{
+	store.beginUpdate();
+	for (int i = 0; i < noValues; i++) store.setValue(i, value);
+	store.endUpdate();
+}
+
+static void testValues()
+{
+	LvarValueStore store;
+	CHECK(store.size() == 0);
+	CHECK(store.getValue(0) == 0.0);
+	store.resize(3000); // Past the initial capacity
+	CHECK(store.size() == 3000);
+	store.setValue(2999, 1.5);
+	CHECK(store.getValue(2999) == 1.5);
+	CHECK(store.getValue(3000) == 0.0);
+	CHECK(store.getValue(-1) == 0.0);
+
+	int ids[] = { 2999, -1, 5000, 0 };
+	double values[4];
+	store.getValues(ids, values, 4);
+	CHECK(values[0] == 1.5 && values[1] == 0.0 && values[2] == 0.0 && values[3] == 0.0);
+
+	store.resize(10);
+	store.resize(3000); // Values past the size are set to 0.0 when it grows again
+	CHECK(store.getValue(2999) == 0.0);
+}
+
+static void testConsistentCopy()
+{
+	// A copy taken while the writer is updating must hold the values of one update only
+	const int noValues = 4096;
+	LvarValueStore store;
+	store.resize(noValues);
+	atomic<bool> stop(false);
+	thread writer([&]() {
+		for (int update = 1; !stop; update++) writeBlock(store, noValues, update);
+	});
+
+	vector<double> values(noValues);
+	int torn = 0;
+	for (int i = 0; i < 2000; i++) {
+		CHECK(store.getValues(values.data(), noValues) == noValues);
+		for (int j = 1; j < noValues; j++) {
+			if (values[j] != values[0]) {
+				torn++;
+				break;
+			}
+		}
+	}
+	stop = true;
+	writer.join();
+	CHECK(torn == 0);
+}
+
+void testLvarValueStore()
+{
+	testValues();
+	testConsistentCopy();
+}
+
+
+void benchLvarValueStore()
+{
+	// Read throughput of getValue with 1, 4 and 16 reader threads while 8 value CDAs (8192 values)
+	// are updated at 60 Hz, against the vector and lock that the store replaced
+	const int noValues = 8192;
+	const double duration = 0.5;
+	const int threadCounts[] = { 1, 4, 16 };
+	for (int noReaders : threadCounts) {
+		for (int locked = 0; locked < 2; locked++) {
+			LvarValueStore store;
+			store.resize(noValues);
+			vector<double> lockedValues(noValues);
+			CRITICAL_SECTION mutex;
+			InitializeCriticalSection(&mutex);
+
+			atomic<bool> stop(false);
+			atomic<long long> noReads(0);
+			thread writer([&]() {
+				for (int update = 1; !stop; update++) {
+					if (locked) {
+						EnterCriticalSection(&mutex);
+						for (int i = 0; i < noValues; i++) lockedValues[i] = update;
+						LeaveCriticalSection(&mutex);
+					}
+					else writeBlock(store, noValues, update);
+					Sleep(1000 / 60);
+				}
+			});
+			vector<thread> readers;
+			for (int r = 0; r < noReaders; r++) {
+				readers.emplace_back([&, r]() {
+					long long reads = 0;
+					double sum = 0;
+					for (int id = r; !stop; id = (id + 97) % noValues, reads++) {
+						if (locked) {
+							EnterCriticalSection(&mutex);
+							sum += lockedValues[id];
+							LeaveCriticalSection(&mutex);
+						}
+						else sum += store.getValue(id);
+					}
+					noReads += reads + (sum < 0);
+				});
+			}
+			Sleep((DWORD)(duration * 1000));
+			stop = true;
+			for (thread& reader : readers) reader.join();
+			writer.join();
+			DeleteCriticalSection(&mutex);
+
+			printf("LvarValueStore, %2d readers, 60 Hz updates: %s %8.1f M reads/s\n", noReaders,
+				locked ? "vector + lock" : "store        ", noReads / duration / 1e6);
+		}
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <windows.h>
+#include <stdio.h>
+
+// Minimal checks for the unit tests: a failed check is reported and counted, and the test run
+// returns a non-zero exit code if any check failed.
+extern int testFailures;
+
+#define CHECK(condition) do { if (!(condition)) { fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #condition); testFailures++; } } while (0)
+
+// Wall clock time in seconds, for the benchmarks
+inline double benchTime()
+{
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+void testCallbackQueue();
+void testLvarChangeTracker();
+void testLvarValueParser();
+void testLvarValueStore();
+void testValueDiff();
+void testVarNameIndex();
+void testWASMIF(); // Runs WASMIF against the stand-in SimConnect of FakeSimConnect.cpp
+
+// Benchmarks - only run when the test program is started with --bench
+void benchLvarValueParser();
+void benchLvarValueStore();
+void benchValueDiff();
+void benchVarNameIndex();
+void benchWASMIF();
@@ -0,0 +1,28 @@
+#include "Test.h"
+#include <string.h>
+
+int testFailures = 0;
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && !strcmp(argv[1], "--bench")) {
+		benchLvarValueParser();
+		benchLvarValueStore();
+		benchValueDiff();
+		benchVarNameIndex();
+		benchWASMIF();
+		return 0;
+	}
+
+	testCallbackQueue();
+	testLvarChangeTracker();
+	testLvarValueParser();
+	testLvarValueStore();
+	testValueDiff();
+	testVarNameIndex();
+	testWASMIF();
+
+	if (testFailures) fprintf(stderr, "%d check(s) failed\n", testFailures);
+	else printf("All tests passed\n");
+	return testFailures ? 1 : 0;
+}
@@ -0,0 +1,97 @@
+#include "Test.h"
+#include "ValueDiff.h"
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+using namespace ValueDiffMSFS;
+
+static bool isChanged(const vector<unsigned long long>& mask, size_t i)
+{
+	return (mask[i / 64] >> (i % 64)) & 1;
+}
+
+static void testDiff()
+{
+	// All block sizes up to and past two SIMD words, with a changed value at each position
+	for (size_t noValues = 1; noValues <= 200; noValues++) {
+		vector<double> previous(noValues), incoming(noValues);
+		for (size_t i = 0; i < noValues; i++) previous[i] = incoming[i] = i * 0.5;
+		vector<unsigned long long> mask((noValues + 63) / 64);
+		CHECK(!diffValues(previous.data(), incoming.data(), noValues, mask.data()));
+		for (size_t changed = 0; changed < noValues; changed++) {
+			incoming[changed] += 1.0;
+			CHECK(diffValues(previous.data(), incoming.data(), noValues, mask.data()));
+			for (size_t i = 0; i < noValues; i++) CHECK(isChanged(mask, i) == (i == changed));
+			incoming[changed] -= 1.0;
+		}
+	}
+}
+
+static void testBitwise()
+{
+	// Values are compared bit for bit: -0.0 differs from 0.0, and an unchanged NaN is unchanged
+	vector<double> previous(128, 0.0), incoming(128, 0.0);
+	previous[3] = previous[100] = NAN;
+	incoming[3] = incoming[100] = NAN;
+	incoming[70] = -0.0;
+	vector<unsigned long long> mask(2);
+	CHECK(diffValues(previous.data(), incoming.data(), 128, mask.data()));
+	CHECK(mask[0] == 0 && mask[1] == 1ULL << 6);
+	CHECK(lowestSetBit(mask[1]) == 6);
+	CHECK(lowestSetBit(1ULL << 63) == 63);
+}
+
+void testValueDiff()
+{
+	testDiff();
+	testBitwise();
+}
+
+
+void benchValueDiff()
+{
+	// Change detection of one value CDA (1024 values) with few changes, against the per-value loop it
+	// replaced, which compared each value and collected the changes (and the callback flags) in vectors
+	const size_t noValues = 1024;
+	vector<double> previous(noValues), incoming(noValues);
+	for (size_t i = 0; i < noValues; i++) previous[i] = incoming[i] = (double)i;
+	for (size_t i = 0; i < noValues; i += 100) incoming[i] += 1.0;
+	vector<bool> flagged(noValues, true);
+	vector<unsigned long long> mask(noValues / 64);
+	const int rounds = 20000;
+
+	long long noChanged = 0;
+	double start = benchTime();
+	for (int round = 0; round < rounds; round++) {
+		if (diffValues(previous.data(), incoming.data(), noValues, mask.data())) {
+			for (unsigned long long bits : mask) {
+				for (; bits; bits &= bits - 1) noChanged++;
+			}
+		}
+	}
+	double diffTime = benchTime() - start;
+
+	vector<int> ids;
+	vector<double> values;
+	vector<bool> callbacks;
+	start = benchTime();
+	for (int round = 0; round < rounds; round++) {
+		ids.clear();
+		values.clear();
+		callbacks.clear();
+		for (size_t i = 0; i < noValues; i++) {
+			if (previous[i] != incoming[i]) {
+				ids.push_back((int)i);
+				values.push_back(incoming[i]);
+				callbacks.push_back(flagged[i]);
+			}
+		}
+		noChanged -= ids.size();
+	}
+	double loopTime = benchTime() - start;
+
+	printf("ValueDiff, %zu values, 11 changed: diffValues %6.0f ns/block, per-value loop %6.0f ns/block%s\n", noValues,
+		diffTime * 1e9 / rounds, loopTime * 1e9 / rounds, noChanged ? " (MISMATCH)" : "");
+}
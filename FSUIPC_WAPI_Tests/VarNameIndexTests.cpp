@@ -0,0 +1,155 @@
+#include "Test.h"
+#include "VarNameIndex.h"
+#include <atomic>
+#include <thread>
+
+using namespace VarNameIndexMSFS;
+
+static void setName(VarNameIndex& index, int id, const string& name)
+{
+	index.setName(id, name.c_str(), name.size());
+}
+
+static void testFind()
+{
+	vector<string> names;
+	VarNameIndex index(names);
+	CHECK(index.find("A") == -1);
+	for (int i = 0; i < 1000; i++) setName(index, i, "L:Var" + to_string(i));
+	CHECK(names.size() == 1000);
+	for (int i = 0; i < 1000; i++) CHECK(index.find("L:Var" + to_string(i)) == i);
+	CHECK(index.find("L:Var1000") == -1);
+	CHECK(index.find("") == -1);
+}
+
+static void testOutOfOrder()
+{
+	// Name CDAs may arrive in any order
+	vector<string> names;
+	VarNameIndex index(names);
+	setName(index, 5, "E");
+	setName(index, 2, "B");
+	CHECK(names.size() == 6);
+	CHECK(index.find("E") == 5);
+	CHECK(index.find("B") == 2);
+}
+
+static void testRename()
+{
+	// A name replaced by a reload must no longer be found under its old id
+	vector<string> names;
+	VarNameIndex index(names);
+	for (int i = 0; i < 100; i++) setName(index, i, "Old" + to_string(i));
+	for (int i = 0; i < 100; i += 2) setName(index, i, "New" + to_string(i));
+	for (int i = 0; i < 100; i++) {
+		if (i % 2) CHECK(index.find("Old" + to_string(i)) == i);
+		else {
+			CHECK(index.find("Old" + to_string(i)) == -1);
+			CHECK(index.find("New" + to_string(i)) == i);
+		}
+	}
+}
+
+static void testDuplicates()
+{
+	// The lowest id is kept for a duplicate name, whatever the order the names arrive in
+	vector<string> names;
+	VarNameIndex index(names);
+	setName(index, 7, "Dup");
+	setName(index, 3, "Dup");
+	CHECK(index.find("Dup") == 3);
+	setName(index, 9, "Dup");
+	CHECK(index.find("Dup") == 3);
+}
+
+static void testResize()
+{
+	vector<string> names;
+	VarNameIndex index(names);
+	for (int i = 0; i < 300; i++) setName(index, i, "Var" + to_string(i));
+	index.resize(100);
+	CHECK(names.size() == 100);
+	CHECK(index.find("Var99") == 99);
+	CHECK(index.find("Var100") == -1);
+	CHECK(index.find("Var299") == -1);
+	setName(index, 150, "Var150");
+	CHECK(index.find("Var150") == 150);
+	index.clear();
+	CHECK(names.empty());
+	CHECK(index.find("Var1") == -1);
+}
+
+static void testConcurrentFind()
+{
+	// Lookups on other threads while the names are reloaded (and the table regrown) must always
+	// return either -1 or the id the name is held at
+	vector<string> names;
+	VarNameIndex index(names);
+	atomic<bool> done(false);
+	atomic<int> wrongIds(0);
+	vector<thread> readers;
+	for (int r = 0; r < 4; r++) {
+		readers.emplace_back([&, r]() {
+			while (!done) {
+				for (int i = r; i < 2000; i += 37) {
+					int id = index.find("L:Var" + to_string(i));
+					if (id != -1 && id != i) wrongIds++;
+				}
+			}
+		});
+	}
+	for (int reload = 0; reload < 20; reload++) {
+		index.resize(reload % 3 ? 10 : 0);
+		for (int i = 0; i < 2000; i++) setName(index, i, "L:Var" + to_string(i));
+	}
+	done = true;
+	for (thread& reader : readers) reader.join();
+	CHECK(wrongIds == 0);
+	CHECK(index.find("L:Var1999") == 1999);
+}
+
+void testVarNameIndex()
+{
+	testFind();
+	testOutOfOrder();
+	testRename();
+	testDuplicates();
+	testResize();
+	testConcurrentFind();
+}
+
+void benchVarNameIndex()
+{
+	// Lookup by name through the index against the linear scan it replaced, for typical lvar counts
+	const int counts[] = { 146, 1024, 2044 };
+	for (int noNames : counts) {
+		vector<string> names;
+		VarNameIndex index(names);
+		for (int i = 0; i < noNames; i++) setName(index, i, "L:A32NX_OVHD_ELEC_BAT_" + to_string(i) + "_PB_IS_AUTO");
+		vector<string> lookups(names);
+
+		const int rounds = 200000 / noNames + 1;
+		long long found = 0;
+		double start = benchTime();
+		for (int round = 0; round < rounds; round++)
+			for (const string& name : lookups) found += index.find(name);
+		double indexTime = benchTime() - start;
+
+		start = benchTime();
+		for (int round = 0; round < rounds; round++) {
+			for (const string& name : lookups) {
+				for (int i = 0; i < noNames; i++) {
+					if (names[i] == name) {
+						found -= i;
+						break;
+					}
+				}
+			}
+		}
+		double scanTime = benchTime() - start;
+
+		double noLookups = (double)rounds * noNames;
+		printf("VarNameIndex, %4d names: index %8.1f ns/lookup, linear scan %8.1f ns/lookup%s\n", noNames,
+			indexTime * 1e9 / noLookups, scanTime * 1e9 / noLookups, found ? " (MISMATCH)" : "");
+	}
+}
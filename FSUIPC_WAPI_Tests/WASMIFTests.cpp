@@ -0,0 +1,492 @@
+#include "Test.h"
+#include "WASMIF.h"
+#include "FakeSimConnect.h"
+#include <thread>
+#include <algorithm>
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+using namespace FakeSimConnectMSFS;
+
+// WASMIF against the stand-in SimConnect/WASM of FakeSimConnect.cpp
+
+static void noLogging(const char* logString) {}
+
+static atomic<int> cdaUpdates;
+static void onCdaUpdate() { cdaUpdates++; }
+
+static WASMIF* startWASMIF(int supportedProtocolFlags, int noLvars, int noHvars, void (*configure)(WASMIF* wasmif) = NULL)
+{
+	// Loads the WASM, and returns a started instance once all the lvars and their values have been received.
+	// The configure function is called before start, for the settings that must be made then
+	resetFakeWasm(supportedProtocolFlags);
+	loadFakeWasm(noLvars, noHvars);
+	cdaUpdates = 0;
+	WASMIF* wasmif = WASMIF::CreateInstance(NULL, EVENT_START_NO, noLogging);
+	wasmif->setLogLevel(DISABLE_LOG);
+	wasmif->registerUpdateCallback(onCdaUpdate);
+	if (configure) configure(wasmif);
+	CHECK(wasmif->start());
+	CHECK(waitFor([&]() { return cdaUpdates > 0 && wasmif->getLvarNames()->size() == (size_t)noLvars; }, 5000));
+	return wasmif;
+}
+
+static bool lvarsMatch(WASMIF* wasmif, const vector<double>& expected)
+{
+	vector<double> values(expected.size() + 1);
+	return wasmif->getLvarValues(values.data(), values.size()) == expected.size() &&
+		equal(expected.begin(), expected.end(), values.begin());
+}
+
+
+static void testStress8K()
+{
+	// All 8192 lvars the value CDAs can hold, across 57 name CDAs and 8 value CDAs, with a reader
+	// running throughout full value updates and reloads that change the number of lvars
+	const int noLvars = MAX_NO_VALUE_CDAS * 1024;
+	WASMIF* wasmif = startWASMIF(WAPI_PROTOCOL_FLAGS, noLvars, 16);
+	CHECK(getFakeProtocolFlags() == WAPI_PROTOCOL_FLAGS);
+	CHECK(wasmif->getLvarIdFromName("Lvar0") == 0);
+	CHECK(wasmif->getLvarIdFromName("Lvar8191") == noLvars - 1);
+	CHECK(wasmif->getHvarIdFromName("H:Hvar15") == 15);
+	auto names = wasmif->getLvarNames();
+	CHECK(names->size() == noLvars && names->at(4321) == "Lvar4321");
+
+	atomic<bool> stop(false);
+	atomic<int> badReads(0);
+	thread reader([&]() {
+		// Names and ids must always agree, whatever the number of lvars loaded
+		while (!stop) {
+			auto snapshot = wasmif->getLvarNames();
+			int id = (int)(snapshot->size() - 1);
+			if (id >= 0 && snapshot->at(id) != "Lvar" + to_string(id)) badReads++;
+			int found = wasmif->getLvarIdFromName("Lvar100");
+			if (found != -1 && found != 100) badReads++;
+			wasmif->getLvar(id);
+		}
+	});
+
+	vector<double> values(noLvars);
+	for (int round = 1; round <= 20; round++) {
+		if (round % 5 == 0) {
+			// Reload with fewer lvars, and then with all of them again
+			loadFakeWasm(noLvars - 500, 16);
+			CHECK(waitFor([&]() { return wasmif->getLvarNames()->size() == noLvars - 500 && wasmif->getLvarIdFromName("Lvar8000") == -1; }, 5000));
+			loadFakeWasm(noLvars, 16);
+			CHECK(waitFor([&]() { return wasmif->getLvarNames()->size() == noLvars && wasmif->getLvarIdFromName("Lvar8000") == 8000; }, 5000));
+		}
+		for (int i = 0; i < noLvars; i++) values[i] = round * 10000.0 + i;
+		setFakeLvars(0, values.data(), noLvars);
+		CHECK(waitFor([&]() { return lvarsMatch(wasmif, values); }, 2000));
+	}
+	stop = true;
+	reader.join();
+	CHECK(badReads == 0);
+	CHECK(lvarsMatch(wasmif, values));
+	WASMIF::DestroyInstance(wasmif);
+}
+
+
+static CRITICAL_SECTION callbackMutex;
+static map<int, double> callbackUpdates; // Last value passed to the lvar update callback, by id
+
+static void onLvarUpdate(int id[], double newValue[])
+{
+	EnterCriticalSection(&callbackMutex);
+	for (int i = 0; id[i] != -1; i++) callbackUpdates[id[i]] = newValue[i];
+	LeaveCriticalSection(&callbackMutex);
+}
+
+static map<int, double> takeCallbackUpdates()
+{
+	map<int, double> updates;
+	EnterCriticalSection(&callbackMutex);
+	updates.swap(callbackUpdates);
+	LeaveCriticalSection(&callbackMutex);
+	return updates;
+}
+
+
+static void testLoopback(bool delta)
+{
+	// The same updates, sent with the full encoding (value CDAs) or the delta encoding ((id, value) pairs),
+	// must give the same values and the same callbacks
+	const int noLvars = 2000;
+	int flags = delta ? WAPI_PROTOCOL_FLAGS : WAPI_PROTOCOL_FLAGS & ~PROTOCOL_DELTA_VALUES;
+	WASMIF* wasmif = startWASMIF(flags, noLvars, 0);
+	CHECK(getFakeProtocolFlags() == flags);
+	InitializeCriticalSection(&callbackMutex);
+	takeCallbackUpdates();
+	wasmif->registerLvarUpdateCallback(onLvarUpdate);
+	for (int id = 0; id < noLvars; id += 7) wasmif->flagLvarForUpdateCallback(id);
+
+	vector<double> values(noLvars, 0.0);
+	unsigned int seed = 12345;
+	for (int round = 0; round < 50; round++) {
+		// Up to MAX_NO_DELTA_ITEMS distinct lvars, spread over all the value CDAs. Some are set to the value they already have
+		vector<int> ids;
+		vector<double> newValues;
+		map<int, double> expected;
+		vector<bool> used(noLvars, false);
+		int noChanges = 1 + (seed = seed * 1103515245 + 12345) % MAX_NO_DELTA_ITEMS;
+		for (int i = 0; i < noChanges; i++) {
+			int id = (seed = seed * 1103515245 + 12345) % noLvars;
+			if (used[id]) continue;
+			used[id] = true;
+			double value = i % 10 ? round + i / 1000.0 : values[id];
+			ids.push_back(id);
+			newValues.push_back(value);
+			if (id % 7 == 0 && value != values[id]) expected[id] = value;
+			values[id] = value;
+		}
+		size_t messagesBefore = getFakeMessagesSent();
+		if (delta) sendFakeDelta(ids.data(), newValues.data(), (int)ids.size());
+		else setFakeLvars(0, values.data(), noLvars);
+		CHECK(waitFor([&]() { return lvarsMatch(wasmif, values); }, 2000));
+		if (delta) CHECK(getFakeMessagesSent() == messagesBefore + 1); // Only the delta CDA is sent
+		CHECK(waitFor([&]() {
+			EnterCriticalSection(&callbackMutex);
+			bool received = callbackUpdates.size() >= expected.size();
+			LeaveCriticalSection(&callbackMutex);
+			return received;
+		}, 2000));
+		CHECK(takeCallbackUpdates() == expected);
+	}
+	WASMIF::DestroyInstance(wasmif);
+	DeleteCriticalSection(&callbackMutex);
+}
+
+
+static void testSetHvars()
+{
+	// One write of the hvars CDA, in order and without the invalid ids, or one event per hvar if the WASM does not support it
+	const int ids[] = { 3, -1, 5, 7 };
+	for (int batched = 1; batched >= 0; batched--) {
+		WASMIF* wasmif = startWASMIF(batched ? WAPI_PROTOCOL_FLAGS : WAPI_PROTOCOL_FLAGS & ~PROTOCOL_SET_HVARS, 10, 20);
+		takeFakeWrites();
+		takeFakeEvents();
+		wasmif->setHvars(ids, 4);
+		vector<FakeWrite> writes = takeFakeWrites();
+		vector<FakeEvent> events = takeFakeEvents();
+		if (batched) {
+			CHECK(writes.size() == 1 && events.empty());
+			const CDASETHVARS* hvars = (const CDASETHVARS*)writes[0].data.data();
+			CHECK(writes[0].cdaName == HVARS_CDA_NAME);
+			CHECK(hvars->noItems == 3 && hvars->ids[0] == 3 && hvars->ids[1] == 5 && hvars->ids[2] == 7);
+		}
+		else {
+			CHECK(writes.empty() && events.size() == 3);
+			for (size_t i = 0; i < events.size(); i++) CHECK(events[i].eventNo == FAKE_EVENT_SET_HVAR);
+			CHECK(events[0].data == 3 && events[1].data == 5 && events[2].data == 7);
+		}
+		WASMIF::DestroyInstance(wasmif);
+	}
+}
+
+
+static void testCalcCodeHandles()
+{
+	// Registered code is uploaded once and executed by handle: by event without parameters, by a write with them.
+	// If the WASM does not support handles, the text is sent on each execution
+	const char* code = "(L:Lvar1) 1 + (>L:Lvar1)";
+	const double params[] = { 1.5, -2.0 };
+	for (int handles = 1; handles >= 0; handles--) {
+		WASMIF* wasmif = startWASMIF(handles ? WAPI_PROTOCOL_FLAGS : WAPI_PROTOCOL_FLAGS & ~PROTOCOL_CALC_CODE_HANDLES, 10, 0);
+		takeFakeWrites();
+		takeFakeEvents();
+		CHECK(wasmif->registerCalculatorCode("") == -1);
+		int handle = wasmif->registerCalculatorCode(code);
+		CHECK(handle >= 0);
+		vector<FakeWrite> writes = takeFakeWrites();
+		if (handles) {
+			CHECK(writes.size() == 1 && writes[0].cdaName == CCODEREG_CDA_NAME);
+			const CDAREGCALCCODE* regCode = (const CDAREGCALCCODE*)writes[0].data.data();
+			CHECK(regCode->handle == handle && strcmp(regCode->calcCode, code) == 0);
+		}
+		else CHECK(writes.empty());
+
+		wasmif->executeCalculatorCode(handle);
+		wasmif->executeCalculatorCode(handle, params, 2);
+		writes = takeFakeWrites();
+		vector<FakeEvent> events = takeFakeEvents();
+		if (handles) {
+			CHECK(events.size() == 1 && events[0].eventNo == FAKE_EVENT_EXEC_CALC_CODE && events[0].data == (DWORD)handle);
+			CHECK(writes.size() == 1 && writes[0].cdaName == CCODEEXEC_CDA_NAME);
+			const CDAEXECCALCCODE* execCode = (const CDAEXECCALCCODE*)writes[0].data.data();
+			CHECK(execCode->handle == handle && execCode->noParams == 2 && execCode->params[0] == 1.5 && execCode->params[1] == -2.0);
+		}
+		else {
+			CHECK(events.empty() && writes.size() == 2);
+			for (const FakeWrite& write : writes) CHECK(write.cdaName == CCODE_CDA_NAME && strcmp(write.data.data(), code) == 0);
+		}
+
+		wasmif->unregisterCalculatorCode(handle);
+		wasmif->executeCalculatorCode(handle); // Unknown handle: nothing is sent without handles
+		writes = takeFakeWrites();
+		if (handles) CHECK(writes.size() >= 1 && writes[0].cdaName == CCODEREG_CDA_NAME && writes[0].data[offsetof(CDAREGCALCCODE, calcCode)] == '\0');
+		else CHECK(writes.empty());
+		takeFakeEvents();
+		WASMIF::DestroyInstance(wasmif);
+	}
+}
+
+
+static vector<double> takeUpdateRequestTimes()
+{
+	vector<double> times;
+	for (const FakeEvent& event : takeFakeEvents()) {
+		if (event.eventNo == FAKE_EVENT_UPDATE_CDAS) times.push_back(event.time);
+	}
+	return times;
+}
+
+static void testUpdateTimer()
+{
+	// The client update requests are sent by the internal timer, without a window, and stop when the frequency is set to 0
+	WASMIF* wasmif = startWASMIF(WAPI_PROTOCOL_FLAGS, 10, 0);
+	takeFakeEvents();
+	wasmif->setLvarUpdateFrequency(50);
+	Sleep(500);
+	size_t noRequests = takeUpdateRequestTimes().size();
+	CHECK(noRequests >= 10 && noRequests <= 30);
+	unsigned long long counts[LatencyHistogram::NO_BUCKETS];
+	wasmif->getLvarUpdateJitter(counts);
+	unsigned long long noSamples = 0;
+	for (int i = 0; i < LatencyHistogram::NO_BUCKETS; i++) noSamples += counts[i];
+	CHECK(noSamples > 0);
+
+	wasmif->setLvarUpdateFrequency(0);
+	Sleep(100);
+	takeFakeEvents();
+	Sleep(200);
+	CHECK(takeUpdateRequestTimes().empty());
+	WASMIF::DestroyInstance(wasmif);
+}
+
+
+static void queueWrites(WASMIF* wasmif) { wasmif->setWriteQueueing(true); }
+static void queueWritesOnWriteConnection(WASMIF* wasmif) { wasmif->setWriteQueueing(true); wasmif->setWriteConnection(true); }
+
+static void testWriteConnection()
+{
+	// A write is sent the same way whether it is made on the calling thread, queued for the SimConnect thread,
+	// or queued for the thread of the write connection
+	void (*configurations[])(WASMIF*) = { NULL, queueWrites, queueWritesOnWriteConnection };
+	for (auto configure : configurations) {
+		WASMIF* wasmif = startWASMIF(WAPI_PROTOCOL_FLAGS, 10, 0, configure);
+		takeFakeWrites();
+		wasmif->setLvar((unsigned short)5, 1.25);
+		vector<FakeWrite> writes;
+		CHECK(waitFor([&]() {
+			for (FakeWrite& write : takeFakeWrites()) writes.push_back(move(write));
+			return !writes.empty();
+		}, 2000));
+		CHECK(writes.size() == 1 && writes[0].cdaName == LVARVALUE_CDA_NAME);
+		if (!writes.empty()) {
+			const CDASETLVARSEQ* lvar = (const CDASETLVARSEQ*)writes[0].data.data();
+			CHECK(lvar->id == 5 && lvar->lvarValue == 1.25);
+		}
+		WASMIF::DestroyInstance(wasmif);
+	}
+}
+
+
+void testWASMIF()
+{
+	testStress8K();
+	testLoopback(false);
+	testLoopback(true);
+	testSetHvars();
+	testCalcCodeHandles();
+	testUpdateTimer();
+	testWriteConnection();
+}
+
+
+static void benchSetHvars()
+{
+	// Activating 10 hvars in a row (e.g. the MCP buttons on a state restore): with setHvars in one write
+	// of the hvars CDA, and with setHvar and one event each. The stand-in SimConnect has no transport
+	// cost, so the SimConnect calls made matter as much as the time
+	const int noHvars = 10;
+	const int rounds = 20000;
+	int ids[noHvars];
+	for (int i = 0; i < noHvars; i++) ids[i] = i;
+	WASMIF* wasmif = startWASMIF(WAPI_PROTOCOL_FLAGS, 10, noHvars);
+	takeFakeWrites();
+	takeFakeEvents();
+
+	double start = benchTime();
+	for (int round = 0; round < rounds; round++) wasmif->setHvars(ids, noHvars);
+	double batchTime = benchTime() - start;
+	size_t batchCalls = takeFakeWrites().size() + takeFakeEvents().size();
+
+	start = benchTime();
+	for (int round = 0; round < rounds; round++) {
+		for (int i = 0; i < noHvars; i++) wasmif->setHvar(ids[i]);
+	}
+	double eventTime = benchTime() - start;
+	size_t eventCalls = takeFakeWrites().size() + takeFakeEvents().size();
+	WASMIF::DestroyInstance(wasmif);
+
+	printf("WASMIF, %d hvars: setHvars %6.2f us, %.0f SimConnect call(s); setHvar per hvar %6.2f us, %.0f SimConnect calls (%.0f activations/s vs %.0f)\n",
+		noHvars, batchTime * 1e6 / rounds, (double)batchCalls / rounds, eventTime * 1e6 / rounds, (double)eventCalls / rounds,
+		rounds * noHvars / batchTime, rounds * noHvars / eventTime);
+}
+static size_t bytesSent(const vector<FakeWrite>& writes, const vector<FakeEvent>& events)
+{
+	size_t bytes = events.size() * 4; // The event parameter (a 32-bit DWORD in SimConnect)
+	for (const FakeWrite& write : writes) bytes += write.data.size();
+	return bytes;
+}
+
+static void benchCalcCodeHandles()
+{
+	// Executing a registered script, by handle (an event, or a write of the exec CDA with parameters) and as text
+	// when the WASM does not support handles. The WASM side saving is the parse of the text, which is not measured here
+	const char* code = "(L:A32NX_EFIS_L_OPTION, enum) 1 + 5 % (>L:A32NX_EFIS_L_OPTION, enum) (>H:A320_Neo_MFD_BTN_CSTR_1)";
+	const double params[] = { 1.0, 2.0 };
+	const int rounds = 20000;
+	for (int handles = 1; handles >= 0; handles--) {
+		WASMIF* wasmif = startWASMIF(handles ? WAPI_PROTOCOL_FLAGS : WAPI_PROTOCOL_FLAGS & ~PROTOCOL_CALC_CODE_HANDLES, 10, 0);
+		int handle = wasmif->registerCalculatorCode(code);
+		for (int withParams = 0; withParams <= handles; withParams++) {
+			takeFakeWrites();
+			takeFakeEvents();
+			double start = benchTime();
+			for (int round = 0; round < rounds; round++) wasmif->executeCalculatorCode(handle, withParams ? params : NULL, withParams ? 2 : 0);
+			double time = benchTime() - start;
+			vector<FakeWrite> writes = takeFakeWrites();
+			vector<FakeEvent> events = takeFakeEvents();
+			printf("WASMIF, registered calc code: %-19s %6.2f us, %4.0f bytes sent per execution (%.0f executions/s)\n",
+				!handles ? "as text" : withParams ? "by handle + params" : "by handle",
+				time * 1e6 / rounds, (double)bytesSent(writes, events) / rounds, rounds / time);
+		}
+		WASMIF::DestroyInstance(wasmif);
+	}
+}
+
+static atomic<double> callbackTime; // benchTime() of the last lvar update callback
+
+static void onLatencyUpdate(int id[], double newValue[])
+{
+	callbackTime = benchTime();
+}
+
+static void deliverAsync(WASMIF* wasmif) { wasmif->setCallbackDelivery(CALLBACK_DELIVERY_ASYNC); }
+
+static void benchCallbackLatency()
+{
+	// Time from a value CDA being sent to the lvar update callback, with the dispatch thread blocked on the
+	// SimConnect event handle, for inline and asynchronous callback delivery
+	const int samples = 2000;
+	for (int async = 0; async < 2; async++) {
+		WASMIF* wasmif = startWASMIF(WAPI_PROTOCOL_FLAGS & ~PROTOCOL_DELTA_VALUES, 100, 0, async ? deliverAsync : NULL);
+		wasmif->registerLvarUpdateCallback(onLatencyUpdate);
+		wasmif->flagLvarForUpdateCallback(0);
+		vector<double> latencies;
+		for (int i = 1; i <= samples; i++) {
+			double value = i;
+			callbackTime = 0.0;
+			double start = benchTime();
+			setFakeLvars(0, &value, 1);
+			if (!waitFor([]() { return callbackTime != 0.0; }, 1000)) continue;
+			latencies.push_back(callbackTime - start);
+		}
+		WASMIF::DestroyInstance(wasmif);
+		CHECK(latencies.size() == samples);
+		if (latencies.empty()) continue;
+		sort(latencies.begin(), latencies.end());
+		printf("WASMIF, update to callback (%s): median %7.1f us, p99 %7.1f us, max %7.1f us\n", async ? "async " : "inline",
+			latencies[latencies.size() / 2] * 1e6, latencies[latencies.size() * 99 / 100] * 1e6, latencies.back() * 1e6);
+	}
+}
+
+static void benchUpdateJitter()
+{
+	// Jitter of the 50 Hz client update requests (20 ms interval), from the times the requests are received,
+	// and the jitter histogram kept by WASMIF
+	const double interval = 0.020;
+	WASMIF* wasmif = startWASMIF(WAPI_PROTOCOL_FLAGS, 10, 0);
+	wasmif->setLvarUpdateFrequency(50);
+	Sleep(100);
+	takeFakeEvents();
+	Sleep(2000);
+	vector<double> times = takeUpdateRequestTimes();
+	unsigned long long counts[LatencyHistogram::NO_BUCKETS];
+	wasmif->getLvarUpdateJitter(counts);
+	WASMIF::DestroyInstance(wasmif);
+
+	vector<double> deviations;
+	double total = 0.0;
+	for (size_t i = 1; i < times.size(); i++) {
+		deviations.push_back(fabs(times[i] - times[i - 1] - interval));
+		total += times[i] - times[i - 1];
+	}
+	if (deviations.empty()) return;
+	sort(deviations.begin(), deviations.end());
+	printf("WASMIF, 50 Hz update requests: %zu in 2 s, mean interval %6.2f ms, |deviation| p50 %6.0f us, p99 %6.0f us, max %6.0f us\n",
+		times.size(), total / deviations.size() * 1e3, deviations[deviations.size() / 2] * 1e6,
+		deviations[deviations.size() * 99 / 100] * 1e6, deviations.back() * 1e6);
+
+	unsigned long long noSamples = 0, below = 0;
+	for (int i = 0; i < LatencyHistogram::NO_BUCKETS; i++) noSamples += counts[i];
+	int p99 = 0;
+	for (; p99 < LatencyHistogram::NO_BUCKETS - 1 && (below += counts[p99]) * 100 < noSamples * 99; p99++);
+	printf("WASMIF, getLvarUpdateJitter: %llu samples, p99 below %llu us\n", noSamples, 1ULL << p99);
+}
+
+static void benchWriteLatency()
+{
+	// Time from setLvar to the write being received, while the WASM is reloaded over and over (so that all
+	// 65 name and value CDAs are sent on each reload), with the writes queued for the SimConnect thread and
+	// for the thread of the write connection
+	const int samples = 200;
+	const int noLvars = MAX_NO_VALUE_CDAS * 1024;
+	for (int connection = 0; connection < 2; connection++) {
+		WASMIF* wasmif = startWASMIF(WAPI_PROTOCOL_FLAGS, noLvars, 16, connection ? queueWritesOnWriteConnection : queueWrites);
+		atomic<bool> stop(false);
+		thread storm([&]() {
+			for (int reload = 0; !stop; reload++) {
+				loadFakeWasm(reload % 2 ? noLvars - 192 : noLvars, 16);
+				Sleep(10);
+			}
+		});
+		takeFakeWrites();
+
+		vector<double> latencies;
+		for (int i = 0; i < samples; i++) {
+			double start = benchTime();
+			wasmif->setLvar((unsigned short)(i % 100), (double)i);
+			double received = 0.0;
+			waitFor([&]() {
+				for (const FakeWrite& write : takeFakeWrites()) {
+					if (write.cdaName == LVARVALUE_CDA_NAME) received = write.time;
+				}
+				return received != 0.0;
+			}, 2000);
+			if (received != 0.0) latencies.push_back(received - start);
+			Sleep(5);
+		}
+		stop = true;
+		storm.join();
+		WASMIF::DestroyInstance(wasmif);
+		CHECK(latencies.size() == samples);
+		if (latencies.empty()) continue;
+		sort(latencies.begin(), latencies.end());
+		printf("WASMIF, setLvar under a reload storm (%s): median %8.1f us, p99 %8.1f us, max %8.1f us\n",
+			connection ? "write connection" : "shared connection", latencies[latencies.size() / 2] * 1e6,
+			latencies[latencies.size() * 99 / 100] * 1e6, latencies.back() * 1e6);
+	}
+}
+
+
+void benchWASMIF()
+{
+	benchSetHvars();
+	benchCalcCodeHandles();
+	benchCallbackLatency();
+	benchUpdateJitter();
+	benchWriteLatency();
+}